@@ -0,0 +1,19 @@
+#ifndef __DSM_ADAPT_H_
+#define __DSM_ADAPT_H_
+
+#include "dsmtypes.h"
+#include "dsm.h"
+
+// requests for a page per classification
+#define DSM_ADAPT_WINDOW        8
+
+// windows in a row a page has to show a new class before it switches
+#define DSM_ADAPT_HYSTERESIS    2
+
+void dsm_adapt_init(dsm_page_sharing *sharing);
+void dsm_adapt_read(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t node_idx);
+void dsm_adapt_write(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t node_idx);
+int dsm_adapt_exclusive(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset);
+int dsm_adapt_update(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset);
+
+#endif
@@ -2,13 +2,25 @@
 #define DSM_COMM_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// largest backtrace of a request a raw REP socket answers; see comm_init_mux_rep
+#define COMM_HDR_MAX 64
 
 typedef struct comm_struct {
   int sock;
   int endpoint;
+  // raw REP socket: the backtrace of the request being served, which its
+  // reply is sent with
+  int raw;
+  size_t hdr_size;
+  uint8_t hdr[COMM_HDR_MAX];
 } comm;
 
 int comm_init(comm *c, int is_req);
+int comm_init_mux(comm *c);
+int comm_init_mux_rep(comm *c);
 int comm_close(comm *c);
 
 int comm_connect(comm *c, const char *host, uint32_t port);
@@ -16,7 +28,13 @@ int comm_bind(comm *c, int port);
 int comm_shutdown(comm *c);
 
 int comm_send_data(comm *c, void *data, size_t size);
+void *comm_alloc(comm *c, size_t size);
+int comm_send_msg(comm *c, void *msg, size_t size);
 void* comm_receive_data(comm *c, ssize_t *size);
+int comm_send_tagged(comm *c, uint32_t id, void *data, size_t size,
+    const void *tail, size_t tail_size);
+void* comm_receive_tagged(comm *c, uint32_t *id, ssize_t *size);
+int comm_receive_fd(comm *c);
 
 void comm_free(comm *c, void *p);
 
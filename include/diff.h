@@ -0,0 +1,26 @@
+#ifndef __DSM_DIFF_H_
+#define __DSM_DIFF_H_
+
+#include "dsmtypes.h"
+#include "dsm.h"
+
+// header of a run of changed bytes in a diff; the bytes follow it
+typedef struct packed dsm_diff_run_struct {
+  uint32_t offset;              // from the start of the page
+  uint32_t len;
+} dsm_diff_run;
+
+// room a diff of a block of len bytes needs at most; every other byte changed
+#define DSM_DIFF_MAX_SIZE(len)  (((len)/2 + 1)*(sizeof(dsm_diff_run) + 1))
+
+size_t dsm_diff_encode(const uint8_t *page, const uint8_t *twin, size_t len, uint8_t *diff);
+int dsm_diff_apply(uint8_t *page, size_t len, const uint8_t *diff, size_t size);
+
+uint64_t dsm_diff_copyset(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t writer);
+void dsm_diff_forget(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t writer);
+int dsm_diff_patch(dsm *d, dhandle chunk_id, dhandle page_offset, const uint8_t *diff, uint32_t size);
+void dsm_twin_page(dsm_chunk_meta *chunk_meta, dhandle page_offset, const uint8_t *data);
+int dsm_diff_flush(dsm *d, dhandle chunk_id);
+int dsm_diff_drop(dsm *d, dhandle chunk_id, dhandle page_offset);
+
+#endif
@@ -6,26 +6,276 @@
 #include "request.h"
 #include "server.h"
 
+// fault engines; passed as flags to dsm_init
+#define DSM_FAULT_SIGSEGV       0x00    // SIGSEGV handler and mprotect
+#define DSM_FAULT_UFFD          0x01    // userfaultfd fault-service thread
+
+// fault path options; also passed as flags to dsm_init
+#define DSM_NO_PREFETCH         0x02    // fetch only the faulting page
+#define DSM_NO_ADAPT            0x04    // keep the protocol each chunk was allocated with
+
+// chunk options; passed as flags to dsm_alloc_ex
+#define DSM_CHUNK_HUGEPAGE      0x01    // back the chunk with transparent huge pages
+#define DSM_CHUNK_MULTIWRITER   0x02    // release consistent; nodes write concurrently; see diff.c
+#define DSM_CHUNK_WRITEUPDATE   0x04    // multiple-writer; releases update copies instead of invalidating
+#define DSM_CHUNK_DYNAMIC       0x08    // no managers; faults follow the probable owner of the page
+
+// sharing patterns of a page, as its home classifies them; see adapt.c
+#define DSM_SHARING_UNKNOWN     0       // not enough requests seen yet
+#define DSM_SHARING_PRIVATE     1       // used by a single node
+#define DSM_SHARING_READMOSTLY  2       // read by several nodes, not written
+#define DSM_SHARING_MIGRATORY   3       // nodes take turns reading and then writing it
+#define DSM_SHARING_PRODCONS    4       // written by one node, read by others
+#define DSM_SHARING_WRITESHARED 5       // written by several nodes in between
+#define DSM_SHARING_CLASSES     6
+
+// page directory; see dsm_page_manager
+#define DSM_MANAGER_RUN         16      // consecutive pages of a chunk with the same manager
+#define DSM_PEER_PORT_OFFSET    1000    // the peer service of a node listens on its port plus this
+#define DSM_DELIVERY_PORT_OFFSET 2000   // and its delivery service on its port plus this
+
+// address space of the chunks; see dsm_fault_init. Chunk i lives at
+// d->arena + (i << DSM_CHUNK_SHIFT), so a fault address maps to its chunk
+// with a shift. Every node asks for the arena at DSM_ARENA_BASE, so that
+// pointers into the chunks mean the same on all of them
+#define DSM_ARENA_BASE          0x200000000000ULL
+#define DSM_CHUNK_SHIFT         34      // room of each chunk; 16 GiB
+#define DSM_ARENA_SIZE          ((size_t)NUM_CHUNKS << DSM_CHUNK_SHIFT)
+
+// pages whose meta is set up at once, on the first use of one of them
+#define DSM_PAGE_BLOCK          512
+
+// fetch service limits; see fetch.c
+#define DSM_FETCH_SLOTS         4       // requests to each node in flight at once
+#define DSM_FETCH_QUEUE         256     // faults waiting for a free slot
+
+// in-flight fetch state of a page; dsm_page_meta.fetch_state
+#define DSM_FETCH_CLAIMED       0x01    // a fetch of the page is queued or in flight
+#define DSM_FETCH_SENT          0x02    // the request has gone out; it can not change
+#define DSM_FETCH_WANT_WRITE    0x04    // a write fault waits; upgrade the fetch if not sent
+#define DSM_FETCH_WAKE          0x08    // a userfaultfd fault waits; wake it up on completion
+#define DSM_FETCH_REMOTE        0x10    // waits for another node; cleared once the reply is in
+#define DSM_FETCH_DELIVERED     0x20    // the owner sent the page here ahead of the reply
+#define DSM_FETCH_STALE         0x40    // invalidated while prefetched; the reply is dropped
+#define DSM_FETCH_EMPTY         0x80    // no copy here until the fetch is in; not served meanwhile
+
+// state word of a page; dsm_page_meta.state. See dsm_page_lock
+#define DSM_PAGE_BUSY           0x01    // a thread holds the page
+#define DSM_PAGE_WAITERS        0x02    // threads sleep on the word; the holder wakes one up
+#define DSM_PAGE_PARKED         0x04    // GETPAGEs for the page wait in the primary service
+#define DSM_PAGE_SERVE          0x08    // mode: held to serve a fault; may wait for other nodes
+#define DSM_PAGE_HOLDER_SHIFT   4       // node the page is held for; 6 bits, up to 64 nodes
+#define DSM_PAGE_HOLDER_MASK    0x3f0
+#define DSM_PAGE_VERSION        0x400   // added on each release; the bits above count releases
+#define DSM_PAGE_HOLDER(state)  (((state) & DSM_PAGE_HOLDER_MASK) >> DSM_PAGE_HOLDER_SHIFT)
+#define DSM_PAGE_SPINS          32      // yields before a wait for a page changed locally sleeps
+
+// state of a page on each node; one entry per page of every chunk, so it
+// is kept to 32 bytes. Bit i of copyset stands for node i
 typedef struct dsm_page_meta_struct {
-  pthread_mutex_t lock;
-  volatile int nodes_reading[64];
-  volatile int page_prot;
-  volatile int owner_idx;   
+  volatile uint32_t state;  // DSM_PAGE_*: who holds the page, how, and the version
+  // in-flight fetch of this page. Faults on a page with a fetch in flight
+  // wait for it instead of sending a GETPAGE of their own
+  volatile uint32_t fetch_state;  // DSM_FETCH_*; 0 if no fetch is in flight
+  volatile uint32_t fetch_seq;  // bumped when a fetch of this page completes; a futex
+  volatile uint32_t inval_seq;  // bumped when the page is invalidated; under lock
+  // nodes with a copy of the page, as its manager (or the owner of a page of a
+  // dynamic chunk) knows them; the bit of this node is its own copy. Under lock
+  volatile uint64_t copyset;
+  volatile int8_t page_prot;
+  volatile int8_t owner_idx;  // as the manager knows it; the probable owner in a dynamic chunk
+  volatile uint8_t twinned;   // written since the twin was taken; multiple-writer chunks
+  volatile uint8_t exclusive; // no other node has a copy; a write needs no message
+  volatile uint8_t dirty;     // written while exclusive; reported to the home with the page
 #ifdef _DSM_STATS
   volatile sig_atomic_t num_read_faults;
   volatile sig_atomic_t num_write_faults;
 #endif
 } dsm_page_meta;
 
+// sharing pattern of a page seen by its manager; under the page lock.
+// Kept apart from dsm_page_meta as only the manager uses it. See adapt.c
+typedef struct dsm_page_sharing_struct {
+  uint64_t ad_readers;      // nodes which read the page in the current window
+  uint64_t ad_writers;      // nodes which wrote it in the current window
+  uint32_t ad_events;       // requests in the current window
+  uint32_t ad_writes;       // writes among them
+  uint32_t ad_upgrades;     // writes by the node which read the page last
+  int32_t ad_last_reader;   // node of the last read; -1 if the last request was a write
+  uint8_t ad_class;         // DSM_SHARING_* the protocol of the page follows
+  uint8_t ad_candidate;     // class of the last windows, if it differs from ad_class
+  uint8_t ad_streak;        // windows in a row ad_candidate was seen
+} dsm_page_sharing;
+
+// meta of DSM_PAGE_BLOCK consecutive pages of a chunk
+typedef struct dsm_page_block_struct {
+  dsm_page_meta pages[DSM_PAGE_BLOCK];
+  dsm_page_sharing sharing[DSM_PAGE_BLOCK];
+} dsm_page_block;
+
+// a chunk is kept coherent in blocks of block_size bytes. The protocol
+// and the page map call a block a page: page_offset counts blocks and
+// pages[] has one entry per block
 typedef volatile struct dsm_chunk_meta_struct {
-  uint32_t count;               // count of pages in this chunk
-  uint32_t ref_counter;         // used to maintain how many clients are using the shared memory
-  uint32_t clients_using[64];    // used to maintain the list of clients using this chunk
+  uint32_t count;               // count of pages (blocks) in this chunk
+  uint32_t block_size;          // coherence unit in bytes; a multiple of PAGESIZE
+  int flags;                    // DSM_CHUNK_* passed to dsm_alloc_ex
+  uint32_t ref_counter;         // master: nodes which allocated the chunk and did not free it yet
+  int owner_idx;                // node the pages start out with
+  int prot;                     // page_prot the pages of this node start out with
+  uint32_t clients_using[64];    // nodes which allocated the chunk; managers invalidate their copies
   char *g_base_ptr;
+  char *g_alias_ptr;            // always writable view of the chunk; NULL with userfaultfd
+  char *g_twin_ptr;             // twins of the pages of a multiple-writer chunk; see diff.c
   size_t g_chunk_size;
-  dsm_page_meta *pages;
+  // page meta, DSM_PAGE_BLOCK pages at a time; a block is only set up
+  // once a page in it is used. See dsm_chunk_page
+  dsm_page_block *volatile *blocks;
+
+  // read-ahead state of the fault path; see prefetch.c
+  uint32_t ra_next;             // page following the last read-ahead window
+  uint32_t ra_window;           // current window in pages; 0 if not sequential
+
+  // stride predictor state of the fault path; see prefetch.c
+  dhandle st_last;              // last faulting page
+  int32_t st_stride;            // distance between the last two faults
+  uint32_t st_confidence;       // times in a row st_stride was seen
+  uint32_t st_pending;          // a batch was prefetched; st_next is valid
+  int64_t st_next;              // page the stream should fault on after the batch
+
+  // prefetch counters; see dsm_get_prefetch_stats
+  uint64_t readahead_pages;
+  uint64_t stride_pages;
+  uint64_t stride_hits;
+  uint64_t stride_misses;
+
+  // faults which waited for the fetch of another fault; and read fetches
+  // turned into write fetches for a write fault waiting behind them
+  uint64_t fetches_coalesced;
+  uint64_t fetches_upgraded;
+
+  // diffs of multiple-writer pages sent to the master and their total size
+  uint64_t diffs_sent;
+  uint64_t diff_bytes;
+
+  // protocol decisions; see dsm_get_sharing_stats
+  uint64_t sharing_switches;
+  uint64_t exclusive_grants;
+  uint64_t silent_upgrades;
+  uint64_t updates_pushed;
+  uint64_t redirects;
+  uint64_t invalidations_avoided;
+
+  // protection changes of pages and the pages they covered; see
+  // dsm_get_protect_stats
+  uint64_t protect_calls;
+  uint64_t protect_pages;
 } dsm_chunk_meta;
 
+typedef struct dsm_prefetch_stats_struct {
+  uint64_t readahead_pages;     // pages fetched by the sequential read-ahead
+  uint64_t stride_pages;        // pages fetched by the stride predictor
+  uint64_t stride_hits;         // strided streams which picked up after a prefetched batch
+  uint64_t stride_misses;       // strided streams which broke off after a prefetched batch
+} dsm_prefetch_stats;
+
+typedef struct dsm_sharing_stats_struct {
+  uint32_t pages[DSM_SHARING_CLASSES]; // managed pages of each DSM_SHARING_* class
+  uint64_t switches;            // managed pages which moved to another class
+  uint64_t exclusive_grants;    // read faults on managed pages served with an exclusive copy
+  uint64_t silent_upgrades;     // writes to exclusive copies which needed no message
+  uint64_t updates_pushed;      // diffs pushed to readers instead of invalidating them
+  uint64_t redirects;           // faults of this node sent on to another probable owner
+  uint64_t invalidations_avoided; // nodes using the chunk without a copy of a written page
+} dsm_sharing_stats;
+
+typedef struct dsm_protect_stats_struct {
+  uint64_t calls;               // mprotect calls (userfaultfd ioctls) on pages of the chunk
+  uint64_t pages;               // pages they changed; more than calls if ranges were coalesced
+} dsm_protect_stats;
+
+// a fault handed over to the fetch thread
+typedef struct dsm_fetch_job_struct {
+  dhandle chunk_id;
+  dhandle page_offset;
+  uint32_t npages;              // faulting page plus prefetched ones
+  int32_t stride;               // distance in pages between the pages to fetch
+  uint32_t flags;               // FLAG_PAGE_* sent with the request
+  int prot;                     // protection the faulting page is installed with
+  int old_prot;                 // protection to go back to if the fetch fails
+  uint32_t inval_seq;           // inval_seq of the faulting page when it faulted
+  uint32_t hops;                // times the job was redirected
+} dsm_fetch_job;
+
+typedef struct dsm_fetch_struct {
+  pthread_t thread;
+  volatile int terminated;
+
+  // pending faults; head is the next one handed to a slot
+  pthread_mutex_t lock;
+  pthread_cond_t not_full;
+  dsm_fetch_job queue[DSM_FETCH_QUEUE];
+  uint32_t head;
+  uint32_t tail;
+
+  // wakes the fetch thread up when a fault is queued
+  int pipe[2];
+
+  // a connection to each node. Slot i carries at most one request to
+  // node i / DSM_FETCH_SLOTS, on conns[i / DSM_FETCH_SLOTS] as calls[i].
+  // rcvfd[n] polls readable when a reply on conns[n] has arrived
+  dsm_request *conns;
+  int *rcvfd;
+  dsm_call *calls;
+  dsm_fetch_job *jobs;
+  int *busy;
+
+  // jobs redirected to another probable owner; sent before the queued ones.
+  // Room for one job per slot: a queued job only takes a slot while the
+  // jobs in slots and here are fewer than the slots
+  dsm_fetch_job *retry;
+  int nretry;
+} dsm_fetch;
+
+// write notices of multiple-writer chunks; see lrc.c
+typedef struct dsm_lrc_struct {
+  pthread_mutex_t lock;
+  pthread_mutex_t diff_lock;    // diffs of this node are encoded and sent one at a time
+
+  // master: notices left by each node. log[w][i] is notice base[w] + i
+  // of node w; the ones every node has seen are trimmed
+  dsm_write_notice *log[NUM_NODES];
+  uint64_t base[NUM_NODES];
+  uint64_t count[NUM_NODES];    // notices of node w logged so far
+  uint64_t cap[NUM_NODES];
+  uint64_t seen[NUM_NODES][NUM_NODES]; // vt of each node at its last acquire
+
+  // notices of each node this node has seen; its vector timestamp
+  uint64_t vt[NUM_NODES];
+} dsm_lrc;
+
+// a lock of the lock service, as the manager (master) sees it
+typedef struct dsm_lock_meta_struct {
+  int32_t holder;               // node holding the lock; -1 if free
+  uint32_t head;                // waiting nodes are queue[head..tail)
+  uint32_t tail;
+  uint32_t queue[NUM_NODES];
+} dsm_lock_meta;
+
+typedef struct dsm_locks_struct {
+  // master: state of all locks
+  dsm_lock_meta meta[NUM_LOCKS];
+
+  // a lock handed over to this node by its previous holder
+  pthread_mutex_t lock;
+  pthread_cond_t granted_cond;
+  volatile uint8_t granted[NUM_LOCKS];
+
+  // only one thread of this node takes part for a lock at a time
+  pthread_mutex_t local[NUM_LOCKS];
+  uint8_t initialized[NUM_LOCKS];
+} dsm_locks;
+
 typedef struct dsm_struct {
 
   // indicates whether this node is master or not
@@ -43,10 +293,35 @@ typedef struct dsm_struct {
   // background thread to receive requests from other nodes
   pthread_t dsm_daemon;
 
+  // flags passed to dsm_init
+  int flags;
+
+  // fault engine in use; DSM_FAULT_SIGSEGV if userfaultfd is unavailable
+  int fault_mode;
+
+  // userfaultfd descriptor and the thread reading its events;
+  // fault_pipe is used to wake the thread up on close
+  int uffd;
+  int fault_pipe[2];
+  pthread_t fault_thread;
+
+  // address space reserved for all chunks; DSM_ARENA_BASE unless taken
+  char *arena;
+
+  // thread fetching the pages for faults from their managers
+  dsm_fetch fetch;
+
   // cond variable for barrier
   pthread_cond_t barrier_cond;
   pthread_mutex_t barrier_lock;
-  volatile uint64_t barrier_counter;
+  volatile uint64_t barrier_counter;  // arrivals of all nodes at all barriers so far
+  uint64_t barrier_gen;         // barriers this node has entered
+
+  // write notices for release consistency
+  dsm_lrc lrc;
+
+  // lock service
+  dsm_locks locks;
 
   // this points to the client at master_idx
   dsm_request *master;
@@ -57,29 +332,56 @@ typedef struct dsm_struct {
   // handle to listener server on this node
   dsm_server s;
 
-  // this is maintained by the master
-  // for client this structure null
+  // second listener serving the requests managers send on to this node;
+  // it only waits for delivery services, so managers can not deadlock
+  pthread_t peer_daemon;
+  dsm_server peer;
+
+  // connections to the peer services of all nodes
+  dsm_request *peers;
+
+  // third listener, taking the pages owners send straight to this node
+  // for a fault the manager forwarded; it never sends anything
+  pthread_t delivery_daemon;
+  dsm_server delivery;
+
+  // connections to the delivery services of all nodes
+  dsm_request *deliveries;
+
+  // every chunk allocated by any node. The entries of the pages this node
+  // manages also hold their directory state: owner, copyset and sharing
+  // pattern. The master also keeps the allocation of each chunk here
   // TODO make this a hash later; key:value -> chunk_id:list of page meta objects
   dsm_chunk_meta g_dsm_page_map[NUM_CHUNKS];   
 
-  // TODO remove this
-  // copy getpage contents into this buffer instead of 
-  // directly copying to the fault address
-  uint8_t *page_buffer;
-
 } dsm;
 
 /**
  * Initializes the system. Reads the system configuration from dsm.conf file. 
  * Creates a background (dsm_daemon) thread which listens for requests from other nodes. 
  *
+ * With DSM_FAULT_UFFD faults are read by a dedicated thread reading 
+ * userfaultfd events instead of the SIGSEGV handler. If userfaultfd (with 
+ * write-protect support) is not available, the SIGSEGV handler is used.
+ * Either way the pages are fetched by a background (fetch) thread.
+ *
+ * Read faults also prefetch the pages a sequential or strided stream is
+ * going to touch next, in the same request, unless DSM_NO_PREFETCH is set.
+ *
+ * The pages of a chunk are spread over all nodes, each of which keeps
+ * the directory of its share and serves the faults on it; see dsm_alloc_ex.
+ * The manager of a page watches how it is shared and picks the cheapest way
+ * to keep it coherent, unless DSM_NO_ADAPT is set; see dsm_get_sharing_stats.
+ *
  * @param d dsm object
  * @param host name of this node
  * @param port on which this node listens
  * @param is_master whether this node is the master
+ * @param flags DSM_FAULT_SIGSEGV or DSM_FAULT_UFFD, or'ed with DSM_NO_PREFETCH
+ *        and DSM_NO_ADAPT
  * @return 0 if init succeeds; negative value incase of error
  */
-int dsm_init(dsm *d, const char *host, uint32_t port, int is_master);
+int dsm_init(dsm *d, const char *host, uint32_t port, int is_master, int flags);
 
 /**
  * Closes the system. Frees any memory on the heap. 
@@ -105,6 +407,55 @@ int dsm_close(dsm *d);
  */
 void* dsm_alloc(dsm *d, dhandle chunk_id, ssize_t size);
 
+/**
+ * Alloc with a coherence granularity. A fault moves a whole block of
+ * block_size bytes and its manager keeps one entry per block, so large
+ * arrays which are accessed densely are cheaper to share in 64KB or 2MB
+ * blocks. Small chunks written by several nodes are better off with
+ * PAGESIZE blocks. All nodes must use the same block size for a chunk.
+ *
+ * The first node to allocate a chunk owns all of its pages. Runs of
+ * DSM_MANAGER_RUN pages hash to the node which manages them: it tracks
+ * their owner and copies, and every fault on them goes there. Every node
+ * maps every chunk allocated anywhere for that, so the memory of a chunk
+ * is only given back once all nodes freed it.
+ *
+ * With DSM_CHUNK_HUGEPAGE the chunk is aligned to the block size and
+ * backed by transparent huge pages where the kernel allows it. Pair it
+ * with 2MB blocks.
+ *
+ * A DSM_CHUNK_MULTIWRITER chunk is release consistent: several nodes may
+ * write to a page at once, and their changes are merged at the master on
+ * dsm_release. Another node sees them after its next dsm_acquire (both
+ * are part of dsm_barrier_all). This avoids moving pages back and forth
+ * between nodes writing different parts of them, and messages for pages
+ * nobody else wrote. The master manages all pages of such a chunk and
+ * keeps the merged copy.
+ *
+ * DSM_CHUNK_WRITEUPDATE makes a chunk multiple-writer and pushes the diffs
+ * of a release to every node with a copy of the page, rather than having
+ * those nodes drop their copies at acquire. Pages one node writes and many
+ * nodes read in every iteration then stay mapped on the readers.
+ *
+ * The pages of a DSM_CHUNK_DYNAMIC chunk have no manager. Each node keeps
+ * the node it takes to be the owner of a page, and a fault goes there; a
+ * node which is not the owner points the faulting node on to the one it
+ * knows of. Ownership moves with every write, so a page which nodes take
+ * turns at writing is one or two hops away rather than always behind its
+ * manager. Such a chunk can not be multiple-writer.
+ *
+ * @param d dsm object
+ * @param chunk_id integer identifying the shared memory chunk
+ * @param size size of chunk; rounded up to a multiple of block_size
+ * @param block_size power of two multiple of PAGESIZE; 0 for PAGESIZE
+ * @param flags 0, or DSM_CHUNK_HUGEPAGE and one of DSM_CHUNK_MULTIWRITER,
+ *        DSM_CHUNK_WRITEUPDATE or DSM_CHUNK_DYNAMIC or'ed
+ *
+ * @return pointer to the shared memory chunk; NULL if block_size or flags
+ *         are invalid
+ */
+void* dsm_alloc_ex(dsm *d, dhandle chunk_id, ssize_t size, size_t block_size, int flags);
+
 /**
  * Frees the shared memory chunk.
  *
@@ -113,13 +464,113 @@ void* dsm_alloc(dsm *d, dhandle chunk_id, ssize_t size);
  */
 void dsm_free(dsm *d, dhandle chunk_id);
 
+/**
+ * Returns the prefetch counters of a chunk on this node. Useful to
+ * check whether the read-ahead and the stride predictor pay off for
+ * an access pattern.
+ *
+ * @param d dsm object
+ * @param chunk_id integer identifying the shared memory chunk
+ * @param stats filled with the counters
+ * @return 0 on success; -1 if the chunk is not allocated
+ */
+int dsm_get_prefetch_stats(dsm *d, dhandle chunk_id, dsm_prefetch_stats *stats);
+
+/**
+ * Returns how the pages of a chunk are shared and what the library did
+ * about it. The manager sorts each page into a DSM_SHARING_* class from
+ * the requests it serves and switches the page over to the protocol
+ * that fits:
+ *   private, migratory - a read fault gets the only copy, so that the
+ *                        write which follows needs no message
+ *   producer-consumer  - pages of multiple-writer chunks push the diffs
+ *                        of a release to the readers (see
+ *                        DSM_CHUNK_WRITEUPDATE)
+ *   read-mostly, write-shared - the protocol of the chunk
+ * The classes are only counted for the pages this node manages; the
+ * pages of dynamic chunks are not classified.
+ *
+ * @param d dsm object
+ * @param chunk_id integer identifying the shared memory chunk
+ * @param stats filled with the counters
+ * @return 0 on success; -1 if the chunk is not allocated
+ */
+int dsm_get_sharing_stats(dsm *d, dhandle chunk_id, dsm_sharing_stats *stats);
+
+/**
+ * Returns how often this node changed the protection of pages of a
+ * chunk. Each change costs a syscall and a TLB flush on the cores the
+ * process runs on; adjacent pages installed together (a prefetched
+ * batch) are changed with one call.
+ *
+ * @param d dsm object
+ * @param chunk_id integer identifying the shared memory chunk
+ * @param stats filled with the counters
+ * @return 0 on success; -1 if the chunk is not allocated
+ */
+int dsm_get_protect_stats(dsm *d, dhandle chunk_id, dsm_protect_stats *stats);
+
 /**
  * Barrier could be used by application to synchronize control flow.
+ * It is a release followed by an acquire: writes to multiple-writer chunks
+ * made before the barrier on any node are visible on all nodes after it.
  *
  * @param d dsm object
  */
 int dsm_barrier_all(dsm *d);
 
+/**
+ * Makes the writes of this node to multiple-writer chunks visible to
+ * the nodes which acquire after this. Call it before telling another
+ * node (e.g. through a flag in a single-writer chunk) that data is ready.
+ *
+ * @param d dsm object
+ * @return 0 on success; -1 if some writes could not be sent
+ */
+int dsm_release(dsm *d);
+
+/**
+ * Drops the copies of multiple-writer pages which other nodes wrote to
+ * and released since this node last acquired, so that the next access
+ * fetches the current contents.
+ *
+ * @param d dsm object
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_acquire(dsm *d);
+
+/**
+ * Prepares a lock of the lock service for use on this node. Locks are
+ * identified by an integer shared by all nodes, and start out free.
+ *
+ * @param d dsm object
+ * @param lock_id integer below NUM_LOCKS identifying the lock
+ * @return 0 on success; -1 if the lock id is invalid
+ */
+int dsm_lock_init(dsm *d, dhandle lock_id);
+
+/**
+ * Takes a lock. A free lock costs one round trip to the master. Otherwise
+ * the node is queued and the lock is handed to it directly by the node
+ * releasing it. Taking a lock is an acquire: writes to multiple-writer
+ * chunks released by the previous holders are visible after it.
+ *
+ * @param d dsm object
+ * @param lock_id lock passed to dsm_lock_init
+ * @return 0 on success; -1 in case of error, and the lock is not held
+ */
+int dsm_lock(dsm *d, dhandle lock_id);
+
+/**
+ * Releases a lock taken with dsm_lock, by the same thread. Releasing
+ * a lock is a release; see dsm_release.
+ *
+ * @param d dsm object
+ * @param lock_id lock passed to dsm_lock
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_unlock(dsm *d, dhandle lock_id);
+
 #define UNUSED(var) (void)(var)
 
 #endif /* __DSM_H_ */
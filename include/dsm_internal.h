@@ -5,9 +5,21 @@
 #include "dsm.h"
 #include "utils.h"
 
-int dsm_allocchunk_internal(dhandle chunk_id, size_t sz, 
+int dsm_page_manager(dsm *d, dhandle chunk_id, dhandle page_offset);
+int dsm_page_target(dsm *d, dhandle chunk_id, dhandle page_offset);
+dsm_page_meta *dsm_chunk_page(dsm_chunk_meta *chunk_meta, dhandle page_offset);
+dsm_page_sharing *dsm_chunk_sharing(dsm_chunk_meta *chunk_meta, dhandle page_offset);
+dsm_page_meta *dsm_chunk_page_peek(dsm_chunk_meta *chunk_meta, dhandle page_offset);
+void dsm_page_lock(dsm_page_meta *page_meta);
+void dsm_page_serve(dsm_page_meta *page_meta, int requestor_idx);
+int dsm_page_tryserve(dsm_page_meta *page_meta, int requestor_idx);
+void dsm_page_unlock(dsm_page_meta *page_meta);
+int dsm_page_park(dhandle chunk_id, dhandle page_offset,
     const uint8_t *requestor_host, uint32_t requestor_port);
 
+int dsm_allocchunk_internal(dhandle chunk_id, size_t sz, uint32_t block_size,
+    uint32_t flags, int32_t owner_idx, const uint8_t *requestor_host, uint32_t requestor_port);
+
 int dsm_freechunk_internal(dhandle chunk_id, 
     const uint8_t *requestor_host, uint32_t requestor_port);
 
@@ -15,9 +27,29 @@ int dsm_locatepage_internal(dhandle chunk_id,
     dhandle page_offset, int *owner_idx, uint32_t flags);
 
 int dsm_getpage_internal(dhandle chunk_id, dhandle page_offset,
-    uint8_t *host, uint32_t port, uint8_t **data, uint64_t *count, uint32_t flags);
+    uint8_t *host, uint32_t port, uint8_t **data, uint64_t *count, uint32_t flags,
+    uint32_t *rep_flags, int32_t *owner_idx, uint64_t *copyset);
+
+int dsm_getpages_internal(dhandle chunk_id, dhandle page_offset, uint32_t npages, int32_t stride,
+    uint8_t *host, uint32_t port, uint8_t **data, uint64_t *count, uint32_t flags,
+    uint32_t *rep_flags, int32_t *owner_idx, uint64_t *copyset);
+
+int dsm_invalidatepage_internal(dhandle chunk_id, dhandle page_offset,
+    const uint8_t *host, uint32_t port);
+int dsm_page_invalidate(dsm_chunk_meta *chunk_meta, dhandle page_offset);
+
+int dsm_pagediff_internal(dhandle chunk_id, dhandle page_offset, uint32_t node_idx,
+    const uint8_t *diff, uint32_t size, uint64_t *copyset);
+int dsm_pagedata_internal(dhandle chunk_id, dhandle page_offset, uint32_t flags,
+    const uint8_t *data, uint32_t size);
+int dsm_pageupdate_internal(dhandle chunk_id, dhandle page_offset,
+    const uint8_t *diff, uint32_t size);
+int dsm_acquire_internal(uint32_t node_idx, const uint64_t *vt, uint64_t *vt_out,
+    dsm_write_notice **notices, uint32_t *count);
 
-int dsm_invalidatepage_internal(dhandle chunk_id, dhandle page_offset);
+int dsm_lock_internal(dhandle lock_id, uint32_t node_idx);
+int dsm_unlock_internal(dhandle lock_id, uint32_t node_idx, int *next_idx);
+int dsm_lockgrant_internal(dhandle lock_id);
 
 int dsm_barrier_internal();
 int dsm_terminate_internal();
@@ -25,6 +25,13 @@ typedef enum packed dsm_msg_type_enum {
   INVALIDATEPAGE,
   BARRIER,
   TERMINATE,
+  PAGEDIFF,
+  ACQUIRE,
+  LOCK,
+  UNLOCK,
+  LOCKGRANT,
+  PAGEUPDATE,
+  PAGEDATA,
   ERROR,
   PAD_MSG_TYPE_ENUM = INT_MAX
 } dsm_msg_type;
@@ -42,9 +49,21 @@ typedef enum packed dsm_error_enum {
 #define FLAG_PAGE_WRITE         0x01
 #define FLAG_PAGE_READ          0x02
 #define FLAG_PAGE_NOUPDATE      0x04
+#define FLAG_PAGE_EXCLUSIVE     0x08    // reply: no other node has a copy of the page
+#define FLAG_PAGE_DIRTY         0x10    // reply: the page was written while exclusive
+#define FLAG_PAGE_REDIRECT      0x20    // reply: not the owner; ask the node in owner_idx
+#define FLAG_PAGE_FORWARD       0x40    // to the owner: send the page to the requestor; reply: it was
 
 #define HOST_NAME 128
-#define NUM_CHUNKS 64
+#define NUM_CHUNKS 1024
+#define NUM_NODES 64
+#define NUM_LOCKS 256
+
+// a page of a multiple-writer chunk written by some node; see lrc.c
+typedef struct packed dsm_write_notice_struct {
+  dhandle chunk_id;
+  dhandle page_offset;
+} dsm_write_notice;
 
 struct dsm_map {
   uint64_t offset;
@@ -0,0 +1,25 @@
+#ifndef __DSM_FAULT_H_
+#define __DSM_FAULT_H_
+
+#include "dsmtypes.h"
+#include "dsm.h"
+
+int dsm_fault_init(dsm *d);
+int dsm_fault_close(dsm *d);
+
+dhandle dsm_fault_chunk_id(dsm *d, char *addr);
+int dsm_fault_handle(dsm *d, char *addr, int write_fault, int wait);
+
+int dsm_chunk_map(dsm *d, dsm_chunk_meta *chunk_meta, size_t size);
+int dsm_chunk_register(dsm *d, dsm_chunk_meta *chunk_meta, int prot);
+int dsm_chunk_unmap(dsm *d, dsm_chunk_meta *chunk_meta);
+
+int dsm_page_protect(dsm_chunk_meta *chunk_meta, dhandle page_offset, int prot);
+int dsm_pages_protect(dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t npages, int prot);
+int dsm_page_install(dsm_chunk_meta *chunk_meta, dhandle page_offset,
+    const uint8_t *data, int prot);
+int dsm_pages_install(dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t npages,
+    const uint8_t *data, int prot);
+int dsm_page_wake(dsm_chunk_meta *chunk_meta, dhandle page_offset);
+
+#endif
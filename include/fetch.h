@@ -0,0 +1,15 @@
+#ifndef __DSM_FETCH_H_
+#define __DSM_FETCH_H_
+
+#include "dsmtypes.h"
+#include "dsm.h"
+
+int dsm_fetch_init(dsm *d);
+int dsm_fetch_close(dsm *d);
+
+int dsm_fetch_submit(dsm *d, const dsm_fetch_job *job);
+void dsm_fetch_wait(dsm_page_meta *page_meta, uint32_t seq);
+void dsm_fetch_release(dsm_chunk_meta *chunk_meta, dhandle page_offset);
+void dsm_fetch_notify(dsm_page_meta *page_meta);
+
+#endif
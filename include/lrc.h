@@ -0,0 +1,15 @@
+#ifndef __DSM_LRC_H_
+#define __DSM_LRC_H_
+
+#include "dsmtypes.h"
+#include "dsm.h"
+
+int dsm_lrc_init(dsm *d);
+void dsm_lrc_close(dsm *d);
+
+int dsm_lrc_log(dsm *d, uint32_t writer, dhandle chunk_id, dhandle page_offset);
+int dsm_lrc_collect(dsm *d, uint32_t node_idx, const uint64_t *vt,
+    uint64_t *vt_out, dsm_write_notice **notices, uint32_t *count);
+int dsm_lrc_acquire(dsm *d);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __DSM_PREFETCH_H_
+#define __DSM_PREFETCH_H_
+
+#include "dsmtypes.h"
+#include "dsm.h"
+
+// read-ahead window in pages; the window doubles from MIN up to MAX
+// while the faults keep following each other
+#define DSM_READAHEAD_MIN       4
+#define DSM_READAHEAD_MAX       64
+
+// pages the stride predictor fetches per batch
+#define DSM_STRIDE_BATCH        16
+
+// most pages a single fault can fetch
+#define DSM_FETCH_MAX_PAGES     (1 + DSM_READAHEAD_MAX)
+
+// most blocks of block_size bytes a single fault can fetch; a fetch of
+// large blocks carries no more data than DSM_FETCH_MAX_PAGES pages
+#define DSM_FETCH_MAX_BLOCKS(block_size) \
+  ((uint32_t)((block_size) >= (uint32_t)DSM_FETCH_MAX_PAGES*PAGESIZE ? \
+    1 : (uint32_t)DSM_FETCH_MAX_PAGES*PAGESIZE/(block_size)))
+
+uint32_t dsm_readahead(dsm_chunk_meta *chunk_meta, dhandle page_offset);
+uint32_t dsm_stride_predict(dsm_chunk_meta *chunk_meta, dhandle page_offset, int32_t *stride);
+uint32_t dsm_prefetch(dsm_chunk_meta *chunk_meta, dhandle page_offset, int32_t *stride);
+void dsm_prefetch_account(dsm_chunk_meta *chunk_meta, uint32_t fetched, int32_t stride);
+
+#endif
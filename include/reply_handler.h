@@ -14,7 +14,7 @@ typedef struct packed dsm_terminate_struct {
 } dsm_terminate_rep;
 
 typedef struct packed dsm_allocchunk_rep_struct {
-  uint8_t is_owner;
+  int32_t owner_idx;     // node the pages start out with
 } dsm_allocchunk_rep;
 
 typedef struct packed dsm_freechunk_rep_struct {
@@ -28,6 +28,9 @@ typedef struct packed dsm_invalidatepage_rep_struct {
 
 typedef struct packed dsm_getpage_rep_struct {
   uint64_t count; // Number of bytes in data.
+  uint32_t flags; // FLAG_PAGE_EXCLUSIVE, FLAG_PAGE_DIRTY or FLAG_PAGE_REDIRECT for the first page
+  int32_t owner_idx; // dynamic chunks: the node which served the page, or the one to ask
+  uint64_t copyset; // dynamic chunks: nodes the new owner of the page invalidates
   uint8_t data[]; // The data itself.
 } dsm_getpage_rep;
 
@@ -36,6 +39,37 @@ typedef struct packed dsm_locatepage_rep_struct {
   uint8_t host[];
 } dsm_locatepage_rep;
 
+typedef struct packed dsm_pagediff_rep_struct {
+  dhandle chunk_id;
+  dhandle page_offset;
+  uint64_t copyset;      // write-update chunks: nodes to push the diff to
+} dsm_pagediff_rep;
+
+typedef struct packed dsm_pagedata_rep_struct {
+  dhandle chunk_id;
+  dhandle page_offset;
+} dsm_pagedata_rep;
+
+typedef struct packed dsm_acquire_rep_struct {
+  uint64_t vt[NUM_NODES]; // write notices of each node, the ones below included
+  uint32_t count;        // notices in notices
+  dsm_write_notice notices[];
+} dsm_acquire_rep;
+
+typedef struct packed dsm_lock_rep_struct {
+  dhandle lock_id;
+  uint8_t granted;       // 0 if queued; a LOCKGRANT follows
+} dsm_lock_rep;
+
+typedef struct packed dsm_unlock_rep_struct {
+  dhandle lock_id;
+  int32_t next_idx;      // node to hand the lock to; -1 if nobody waits
+} dsm_unlock_rep;
+
+typedef struct packed dsm_lockgrant_rep_struct {
+  dhandle lock_id;
+} dsm_lockgrant_rep;
+
 typedef struct packed dsm_barrier_rep_struct {
   uint8_t tmp;
 } dsm_barrier_rep;
@@ -51,9 +85,18 @@ typedef struct packed dsm_rep_struct {
     dsm_allocchunk_rep allocchunk_rep;
     dsm_terminate_rep terminate_rep;
     dsm_barrier_rep barrier_rep;
+    dsm_pagediff_rep pagediff_rep;
+    dsm_pagedata_rep pagedata_rep;
+    dsm_acquire_rep acquire_rep;
+    dsm_lock_rep lock_rep;
+    dsm_unlock_rep unlock_rep;
+    dsm_lockgrant_rep lockgrant_rep;
   } content;
 } dsm_rep;
 
+dsm_rep *dsm_request_finish(dsm_request *r, dsm_call *call);
+dsm_rep *dsm_request_getpages_recv(dsm_request *r, dsm_call *call);
+
 void handle_noop(comm *c);
 void handle_error(comm *c, dsm_error error);
 void handle_unimplemented(comm *c, dsm_msg_type msg_type);
@@ -64,6 +107,13 @@ void handle_invalidatepage(comm *c, dsm_invalidatepage_args *args);
 void handle_locatepage(comm *c, dsm_locatepage_args *args);
 void handle_barrier(comm *c, dsm_barrier_args *args);
 void handle_terminate(comm *c, dsm_terminate_args *args);
+void handle_pagediff(comm *c, dsm_pagediff_args *args);
+void handle_pageupdate(comm *c, dsm_pagediff_args *args);
+void handle_pagedata(comm *c, dsm_pagedata_args *args);
+void handle_acquire(comm *c, dsm_acquire_args *args);
+void handle_lock(comm *c, dsm_lock_args *args);
+void handle_unlock(comm *c, dsm_lock_args *args);
+void handle_lockgrant(comm *c, dsm_lock_args *args);
 
 /*
  * A convenience macro to generate a dsm_rep structure. The first parameter is
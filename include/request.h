@@ -1,12 +1,33 @@
 #ifndef DSM_REQUESTS_H
 #define DSM_REQUESTS_H
 
+#include <pthread.h>
+
 #include "dsmtypes.h"
 #include "comm.h"
 
+// a request in flight on a dsm_request; see dsm_request_start
+typedef struct dsm_call_struct {
+  uint32_t id;                  // the reply carries it back
+  dsm_msg_type type;
+  volatile int done;            // reply is set, or the call gave up on it
+  struct dsm_rep_struct *reply;
+  struct dsm_call_struct *next;
+} dsm_call;
+
 typedef struct dsm_request_struct {
   comm c;
   int initialized;
+  // the connection is shared by the application threads, the fetch
+  // thread and the dsm_daemon, and any number of their requests may be
+  // in flight on it. The replies are matched to the calls by id; one of
+  // the waiting threads receives for all of them. Guards calls, next_id
+  // and receiving
+  pthread_mutex_t lock;
+  pthread_cond_t replied;
+  dsm_call *calls;
+  uint32_t next_id;
+  int receiving;
   // redundant fields useful 
   // for searching for owner host during getpage
   uint32_t port;
@@ -18,6 +39,8 @@ typedef struct packed dsm_getpage_args_struct {
   dhandle chunk_id;
   dhandle page_offset;
   uint32_t flags;
+  uint32_t npages;       // pages to fetch; the ones after the first are prefetched
+  int32_t stride;        // distance in pages between the pages to fetch
   uint32_t requestor_port;
   uint8_t requestor_host[];
 } dsm_getpage_args;
@@ -33,6 +56,9 @@ typedef struct packed dsm_invalidatepage_args_struct {
 typedef struct packed dsm_allocchunk_args_struct {
   dhandle chunk_id;
   size_t size;
+  uint32_t block_size;
+  uint32_t flags;        // DSM_CHUNK_*
+  int32_t owner_idx;     // node the pages start out with; -1 to ask the master
   uint32_t requestor_port;
   uint8_t requestor_host[HOST_NAME];     // TODO: passing unnecessary data
 } dsm_allocchunk_args;
@@ -52,6 +78,32 @@ typedef struct packed dsm_barrier_args_struct {
   uint8_t tmp;     // TODO: passing unnecessary data
 } dsm_barrier_args;
 
+typedef struct packed dsm_pagediff_args_struct {
+  dhandle chunk_id;
+  dhandle page_offset;
+  uint32_t node_idx;     // writer; this_node_idx of the sender
+  uint32_t size;         // bytes in data
+  uint8_t data[];        // runs of changed bytes; see diff.c
+} dsm_pagediff_args;
+
+typedef struct packed dsm_pagedata_args_struct {
+  dhandle chunk_id;
+  dhandle page_offset;
+  uint32_t flags;        // FLAG_PAGE_* of the fetch, as the manager forwarded it
+  uint32_t size;         // bytes in data; the block size of the chunk
+  uint8_t data[];
+} dsm_pagedata_args;
+
+typedef struct packed dsm_acquire_args_struct {
+  uint32_t node_idx;     // this_node_idx of the sender
+  uint64_t vt[NUM_NODES]; // write notices of each node the sender has seen
+} dsm_acquire_args;
+
+typedef struct packed dsm_lock_args_struct {
+  dhandle lock_id;
+  uint32_t node_idx;     // this_node_idx of the sender
+} dsm_lock_args;
+
 typedef struct packed dsm_terminate_args_struct {
   uint32_t requestor_port;
   uint8_t requestor_host[HOST_NAME];     // TODO: passing unnecessary data
@@ -67,6 +119,11 @@ typedef struct packed dsm_req_struct {
     dsm_freechunk_args freechunk_args;
     dsm_barrier_args barrier_args;
     dsm_terminate_args terminate_args;
+    dsm_pagediff_args pagediff_args;
+    dsm_pagediff_args pageupdate_args;
+    dsm_pagedata_args pagedata_args;
+    dsm_acquire_args acquire_args;
+    dsm_lock_args lock_args;
   } content;
 } dsm_req;
 
@@ -97,13 +154,31 @@ typedef struct packed dsm_req_struct {
 
 int dsm_request_init(dsm_request *r, uint8_t *host, uint32_t port);
 int dsm_request_close(dsm_request *c);
-int dsm_request_allocchunk(dsm_request *r, dhandle chunk_id, size_t size, uint8_t *host, uint32_t port);
+int dsm_request_start(dsm_request *r, dsm_call *call, dsm_req *request, size_t size);
+int dsm_request_next(dsm_request *r, dsm_call **call);
+void dsm_request_cancel(dsm_request *r, dsm_call *call);
+int dsm_request_allocchunk(dsm_request *r, dhandle chunk_id, size_t size, uint32_t block_size, uint32_t flags, int32_t owner_idx, uint8_t *host, uint32_t port);
 int dsm_request_freechunk(dsm_request *r, dhandle chunk_id, uint8_t *requestor_host, uint32_t requestor_port);
-int dsm_request_getpage(dsm_request *r, dhandle chunk_id, dhandle page_offset, uint8_t *host, uint32_t port, uint8_t **page_start_addr, uint32_t flags);
+int dsm_request_getpage(dsm_request *r, dhandle chunk_id, dhandle page_offset, uint8_t *host, uint32_t port, uint8_t **page_start_addr, size_t len, uint32_t flags, uint32_t *rep_flags);
+int dsm_request_getpages_send(dsm_request *r, dsm_call *call, dhandle chunk_id, dhandle page_offset, uint32_t npages, int32_t stride, uint8_t *host, uint32_t port, uint32_t flags);
+int dsm_request_getpages(dsm_request *r, dhandle chunk_id, dhandle page_offset, uint32_t npages, int32_t stride, uint8_t *host, uint32_t port, uint8_t **page_start_addr, size_t len, uint32_t flags, uint32_t *rep_flags);
 int dsm_request_locatepage(dsm_request *r, dhandle chunk_id, dhandle page_offset, uint8_t **host, int *port);
 int dsm_request_invalidatepage(dsm_request *r, dhandle chunk_id, dhandle page_offset, uint8_t *host, uint32_t port, uint32_t flags);
+int dsm_request_invalidatepages(dsm_request *peers, int num_nodes, uint64_t targets, dhandle chunk_id, dhandle page_offset, uint8_t *host, uint32_t port, uint32_t flags);
+int dsm_request_pagediff(dsm_request *r, dhandle chunk_id, dhandle page_offset,
+    uint32_t node_idx, const uint8_t *diff, uint32_t size, uint64_t *copyset);
+int dsm_request_pageupdate(dsm_request *r, dhandle chunk_id, dhandle page_offset,
+    uint32_t node_idx, const uint8_t *diff, uint32_t size);
+int dsm_request_pagedata(dsm_request *r, dhandle chunk_id, dhandle page_offset,
+    uint32_t flags, const uint8_t *data, uint32_t size);
+int dsm_request_acquire(dsm_request *r, uint32_t node_idx, uint64_t *vt,
+    dsm_write_notice **notices, uint32_t *count);
+int dsm_request_lock(dsm_request *r, dhandle lock_id, uint32_t node_idx);
+int dsm_request_unlock(dsm_request *r, dhandle lock_id, uint32_t node_idx);
+int dsm_request_lockgrant(dsm_request *r, dhandle lock_id, uint32_t node_idx);
 
 int dsm_request_barrier(dsm_request *r);
+int dsm_request_barriers(dsm_request *clients, int num_nodes, uint64_t targets);
 
 int dsm_request_terminate(dsm_request *r, uint8_t *requestor_host, uint32_t requestor_port);
 
@@ -3,15 +3,36 @@
 
 #include <stdlib.h>
 #include <signal.h>
+#include <sys/types.h>
+
+#include "comm.h"
+
+// a request put aside until the page it is for is released; see
+// dsm_server_start
+typedef struct dsm_parked_struct {
+  struct dsm_parked_struct *next;
+  void *req;
+  ssize_t size;
+  size_t hdr_size;              // backtrace the reply is sent with
+  uint8_t hdr[COMM_HDR_MAX];
+} dsm_parked;
 
 typedef struct dsm_server_struct {
   uint32_t port;
   int sock;
   // Set to 1 when SIGTERM was received
   volatile sig_atomic_t terminated;
+  // set with dsm_server_park: GETPAGEs for busy pages are parked rather
+  // than waited for
+  int park;
+  int wake_fd;                  // eventfd the holders of the pages wake the server up with
+  dsm_parked *parked;           // in the order they came in
+  dsm_parked **parked_tail;
 } dsm_server;
 
 int dsm_server_init(dsm_server *c, const char *host, uint32_t port);
+int dsm_server_park(dsm_server *c);
+void dsm_server_wake(dsm_server *c);
 int dsm_server_close(dsm_server *c);
 int dsm_server_start(dsm_server *c);
 
@@ -8,6 +8,7 @@
 const char *strmsgtype(dsm_msg_type);
 const char *strflag(int flag);
 const char *strdsmerror(dsm_error);
+const char *strsharing(int sharing);
 void printbuf(void *, size_t n);
 
 #endif
@@ -0,0 +1,146 @@
+/**
+ * Protocol selection per page. The manager of a page sees every fetch of
+ * it and every diff of a multiple-writer page, and sorts the page into one of
+ * the DSM_SHARING_* classes from the last DSM_ADAPT_WINDOW of them:
+ *   private      - one node reads and writes the page
+ *   read-mostly  - several nodes read it, none writes it
+ *   migratory    - several nodes write it, each right after reading it
+ *   prod-cons    - one node writes it, the others read it
+ *   write-shared - several nodes write it in no particular order
+ *
+ * The protocol of the page follows its class:
+ *   private, migratory - a read fault on a single-writer page gets the
+ *     only copy (migrate on read). The write which usually follows just
+ *     unprotects the page; the home learns about it from the dirty bit
+ *     of the copy when it takes the page back.
+ *   prod-cons - a release of a multiple-writer page pushes the diff to
+ *     the readers instead of leaving a write notice which makes them drop
+ *     and fetch the page again (update instead of invalidate).
+ *   read-mostly, write-shared - the protocol of the chunk: replicas for
+ *     single-writer chunks, twins and diffs for multiple-writer ones.
+ *
+ * Single-writer chunks can not switch to multiple writers page by page;
+ * write-shared pages of such chunks are only reported. A page switches to
+ * another class only after DSM_ADAPT_HYSTERESIS windows in a row agree on
+ * it, so that a phase change flips it once rather than back and forth.
+ *
+ * Everything here runs on the manager of the page with the page lock held.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "utils.h"
+#include "dsm.h"
+#include "dsm_internal.h"
+#include "strings.h"
+#include "diff.h"
+#include "adapt.h"
+
+void dsm_adapt_init(dsm_page_sharing *sharing) {
+  sharing->ad_last_reader = -1;
+}
+
+/**
+ * Sorts a page into a class from the requests of the current window.
+ */
+static
+uint8_t dsm_adapt_classify(dsm_page_sharing *sharing) {
+  int nodes = __builtin_popcountll(sharing->ad_readers | sharing->ad_writers);
+  int writers = __builtin_popcountll(sharing->ad_writers);
+
+  if (nodes <= 1)
+    return DSM_SHARING_PRIVATE;
+  if (writers == 0)
+    return DSM_SHARING_READMOSTLY;
+  if (writers == 1)
+    return DSM_SHARING_PRODCONS;
+  if (2*sharing->ad_upgrades >= sharing->ad_writes)
+    return DSM_SHARING_MIGRATORY;
+  return DSM_SHARING_WRITESHARED;
+}
+
+/**
+ * Counts a request and closes the window once it is full. A page leaves
+ * the unknown class after the first window.
+ */
+static
+void dsm_adapt_event(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  dsm_page_sharing *sharing = dsm_chunk_sharing(chunk_meta, page_offset);
+  if (++sharing->ad_events < DSM_ADAPT_WINDOW)
+    return;
+
+  uint8_t class = dsm_adapt_classify(sharing);
+  sharing->ad_readers = 0;
+  sharing->ad_writers = 0;
+  sharing->ad_events = 0;
+  sharing->ad_writes = 0;
+  sharing->ad_upgrades = 0;
+
+  if (class == sharing->ad_class) {
+    sharing->ad_streak = 0;
+    return;
+  }
+  if (class != sharing->ad_candidate) {
+    sharing->ad_candidate = class;
+    sharing->ad_streak = 0;
+  }
+  if (++sharing->ad_streak < DSM_ADAPT_HYSTERESIS &&
+      sharing->ad_class != DSM_SHARING_UNKNOWN)
+    return;
+
+  log("Page chunk_id=%"PRIu64", page_offset=%"PRIu64" is %s now, was %s\n",
+      (dhandle)(chunk_meta - d->g_dsm_page_map), page_offset,
+      strsharing(class), strsharing(sharing->ad_class));
+  sharing->ad_class = class;
+  sharing->ad_streak = 0;
+  __sync_fetch_and_add(&chunk_meta->sharing_switches, 1);
+}
+
+/**
+ * Notes a read of a page by a node: a fetch of a copy.
+ */
+void dsm_adapt_read(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t node_idx) {
+  dsm_page_sharing *sharing = dsm_chunk_sharing(chunk_meta, page_offset);
+  sharing->ad_readers |= 1ULL << node_idx;
+  sharing->ad_last_reader = node_idx;
+  dsm_adapt_event(d, chunk_meta, page_offset);
+}
+
+/**
+ * Notes a write to a page by a node: a write fetch, a diff, or a write
+ * to an exclusive copy. Readers of a page which is being updated do not
+ * fetch it any more; they count as long as they hold a copy.
+ */
+void dsm_adapt_write(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t node_idx) {
+  dsm_page_sharing *sharing = dsm_chunk_sharing(chunk_meta, page_offset);
+  if (dsm_adapt_update(d, chunk_meta, page_offset))
+    sharing->ad_readers |= dsm_diff_copyset(d, chunk_meta, page_offset, node_idx);
+  sharing->ad_writers |= 1ULL << node_idx;
+  sharing->ad_writes++;
+  if (sharing->ad_last_reader == (int32_t)node_idx)
+    sharing->ad_upgrades++;
+  sharing->ad_last_reader = -1;
+  dsm_adapt_event(d, chunk_meta, page_offset);
+}
+
+/**
+ * Returns 1 if a read fault on a page should get the only copy of it.
+ * Only pages of single-writer chunks migrate.
+ */
+int dsm_adapt_exclusive(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  uint8_t class = dsm_chunk_sharing(chunk_meta, page_offset)->ad_class;
+  return !(d->flags & DSM_NO_ADAPT) && !(chunk_meta->flags & DSM_CHUNK_MULTIWRITER) &&
+    (class == DSM_SHARING_PRIVATE || class == DSM_SHARING_MIGRATORY);
+}
+
+/**
+ * Returns 1 if the diffs of a page of a multiple-writer chunk should be
+ * pushed to its readers rather than invalidate their copies.
+ */
+int dsm_adapt_update(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  if (chunk_meta->flags & DSM_CHUNK_WRITEUPDATE)
+    return 1;
+  return !(d->flags & DSM_NO_ADAPT) && (chunk_meta->flags & DSM_CHUNK_MULTIWRITER) &&
+    dsm_chunk_sharing(chunk_meta, page_offset)->ad_class == DSM_SHARING_PRODCONS;
+}
@@ -13,6 +13,7 @@
 #include <sys/time.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <arpa/inet.h>
 
 #ifdef __linux__
 #include <bsd/stdlib.h>
@@ -25,6 +26,79 @@
 #include "strings.h"
 #include "comm.h"
 
+// room for the SP_HDR property of a message: its size, then the header
+#define COMM_CTL_SPACE NN_CMSG_SPACE(sizeof(size_t) + COMM_HDR_MAX)
+
+/**
+ * Sends a message on a raw socket, with `hdr` as its header: the request
+ * id on a raw REQ socket, the backtrace of the request it answers on a
+ * raw REP socket.
+ *
+ * @param iov parts of the message; a single NN_MSG part hands a message
+ *        from comm_alloc over
+ * @return number of bytes sent on success, < 0 on error
+ */
+static
+int comm_send_hdr(comm *c, const void *hdr, size_t hdr_size,
+    struct nn_iovec *iov, int iovlen) {
+  unsigned char control[COMM_CTL_SPACE];
+  struct nn_cmsghdr *cmsg = (struct nn_cmsghdr*)control;
+  memset(control, 0, sizeof(control));
+  cmsg->cmsg_len = NN_CMSG_LEN(sizeof(size_t) + hdr_size);
+  cmsg->cmsg_level = PROTO_SP;
+  cmsg->cmsg_type = SP_HDR;
+  memcpy(NN_CMSG_DATA(cmsg), &hdr_size, sizeof(size_t));
+  memcpy(NN_CMSG_DATA(cmsg) + sizeof(size_t), hdr, hdr_size);
+
+  struct nn_msghdr msg = {
+    .msg_iov = iov,
+    .msg_iovlen = iovlen,
+    .msg_control = control,
+    .msg_controllen = NN_CMSG_SPACE(sizeof(size_t) + hdr_size),
+  };
+  return nn_sendmsg(c->sock, &msg, 0);
+}
+
+/**
+ * Receives a message on a raw socket, along with its header.
+ *
+ * @param[out] data the message; free it with comm_free
+ * @param[out] hdr room for COMM_HDR_MAX bytes of header
+ * @param[out] hdr_size size of the header; 0 if it had none
+ * @return size of the message on success, < 0 on error
+ */
+static
+int comm_receive_hdr(comm *c, void **data, uint8_t *hdr, size_t *hdr_size) {
+  unsigned char control[COMM_CTL_SPACE + 64];
+  struct nn_iovec iov = { .iov_base = data, .iov_len = NN_MSG };
+  struct nn_msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof(control),
+  };
+  *data = NULL;
+  int bytes = nn_recvmsg(c->sock, &msg, 0);
+  if (bytes < 0 || *data == NULL)
+    return -1;
+
+  struct nn_cmsghdr *cmsg = NN_CMSG_FIRSTHDR(&msg);
+  while (cmsg != NULL && !(cmsg->cmsg_level == PROTO_SP && cmsg->cmsg_type == SP_HDR))
+    cmsg = NN_CMSG_NXTHDR(&msg, cmsg);
+  *hdr_size = 0;
+  if (cmsg == NULL)
+    return bytes;
+  memcpy(hdr_size, NN_CMSG_DATA(cmsg), sizeof(size_t));
+  if (*hdr_size > COMM_HDR_MAX) {
+    debug("Receive failed: header of %zu bytes.\n", *hdr_size);
+    nn_freemsg(*data);
+    *data = NULL;
+    return -1;
+  }
+  memcpy(hdr, NN_CMSG_DATA(cmsg) + sizeof(size_t), *hdr_size);
+  return bytes;
+}
+
 /**
  * Sends `size` bytes from the buffer of `data` to the machine referred to by
  * `sock`. This is a blocking send.
@@ -41,7 +115,12 @@ int comm_send_data(comm *c, void *data, size_t size) {
 
   // Try for half a second to send the data.
   int bytes = 0;
-  bytes = nn_send(c->sock, data, size, 0);
+  if (c->raw) {
+    struct nn_iovec iov = { .iov_base = data, .iov_len = size };
+    bytes = comm_send_hdr(c, c->hdr, c->hdr_size, &iov, 1);
+  } else {
+    bytes = nn_send(c->sock, data, size, 0);
+  }
   if (errno < 0) {
     debug("Send failed: '%s'\n", strerror(errno));
     return bytes;
@@ -55,6 +134,54 @@ int comm_send_data(comm *c, void *data, size_t size) {
   return bytes;
 }
 
+/**
+ * Allocates a message of `size` bytes for comm_send_msg. Filling it in
+ * place saves the copy comm_send_data makes of its buffer.
+ *
+ * @return the message on success, NULL on error
+ */
+void *comm_alloc(comm *c, size_t size) {
+  UNUSED(c);
+  void *msg = nn_allocmsg(size, 0);
+  if (msg == NULL)
+    print_err("Failed to allocate %zu bytes for a message: %s\n", size, strerror(errno));
+  return msg;
+}
+
+/**
+ * Sends a message allocated with comm_alloc, cut down to `size` bytes. The
+ * message is handed to nanomsg without being copied; it is gone after the
+ * call, whether or not it was sent.
+ *
+ * @param msg the message; at most as large as it was allocated
+ * @return number of bytes sent on success, < 0 on error
+ */
+int comm_send_msg(comm *c, void *msg, size_t size) {
+  debug("Sending %zu bytes of message (%p):\n", size, msg);
+  if_debug { printbuf(msg, size); }
+
+  void *sized = nn_reallocmsg(msg, size);
+  if (sized == NULL) {
+    debug("Send failed: '%s'\n", strerror(errno));
+    nn_freemsg(msg);
+    return -1;
+  }
+
+  int bytes;
+  if (c->raw) {
+    struct nn_iovec iov = { .iov_base = &sized, .iov_len = NN_MSG };
+    bytes = comm_send_hdr(c, c->hdr, c->hdr_size, &iov, 1);
+  } else {
+    bytes = nn_send(c->sock, &sized, NN_MSG, 0);
+  }
+  if (bytes < 0) {
+    debug("Send failed: '%s'\n", strerror(errno));
+    nn_freemsg(sized);
+    return -1;
+  }
+  return bytes;
+}
+
 /**
  * Receives data from the machine referred to by `sock`. Returns a malloc()d
  * reply if it was received. It is the callers responsibility to free it.
@@ -73,7 +200,11 @@ void* comm_receive_data(comm *c, ssize_t *size) {
   // set recv timeout to 60 seconds
   nn_setsockopt (c->sock, NN_SOL_SOCKET, NN_RCVTIMEO, &timeout, sizeof (timeout));
 
-  bytes = nn_recv(c->sock, &data, NN_MSG, 0);
+  // a raw REP socket keeps the backtrace to send the reply with
+  if (c->raw)
+    bytes = comm_receive_hdr(c, &data, c->hdr, &c->hdr_size);
+  else
+    bytes = nn_recv(c->sock, &data, NN_MSG, 0);
   if (errno == EBADF || errno == ENOTSUP || errno == ETERM) {
     debug("Receive failed: '%s'\n", strerror(errno));
     return NULL;
@@ -93,6 +224,95 @@ void* comm_receive_data(comm *c, ssize_t *size) {
   return data;
 }
 
+// set in the request id on the wire; it ends the backtrace of a request
+#define COMM_ID_LAST 0x80000000u
+
+/**
+ * Sends a request tagged with `id` on a socket set up with comm_init_mux.
+ * The reply carries the same id; see comm_receive_tagged.
+ *
+ * @param id request id; only the low 31 bits are used
+ * @param tail sent right after `data`, gathered from where it is; NULL for
+ *        none
+ * @return number of bytes sent on success, < 0 on error
+ */
+int comm_send_tagged(comm *c, uint32_t id, void *data, size_t size,
+    const void *tail, size_t tail_size) {
+  debug("Sending %zu+%zu bytes of data (%p) tagged %u:\n", size, tail_size, data, id);
+  if_debug { printbuf(data, size); }
+
+  // the raw socket takes the header as is: the request id, big-endian
+  uint32_t hdr = htonl(id | COMM_ID_LAST);
+  struct nn_iovec iov[2] = {
+    { .iov_base = data, .iov_len = size },
+    { .iov_base = (void*)tail, .iov_len = tail_size },
+  };
+  int bytes = comm_send_hdr(c, &hdr, sizeof(hdr), iov, tail != NULL ? 2 : 1);
+  if (bytes != (int) (size + (tail != NULL ? tail_size : 0))) {
+    debug("Send failed: '%s'\n", strerror(errno));
+    return -1;
+  }
+  return bytes;
+}
+
+/**
+ * Receives the next reply on a socket set up with comm_init_mux, whatever
+ * request it answers. Returns a malloc()d reply if it was received. It is
+ * the callers responsibility to free it with comm_free.
+ *
+ * @param[out] id id the request was sent with
+ * @param[out] size size in bytes of the received data
+ *
+ * @return malloc()d reply is it was received, NULL otherwise
+ */
+void* comm_receive_tagged(comm *c, uint32_t *id, ssize_t *size) {
+  int timeout = 60000;
+  void *data = NULL;
+  uint8_t hdr[COMM_HDR_MAX];
+  size_t hdr_size = 0;
+
+  // set recv timeout to 60 seconds
+  nn_setsockopt(c->sock, NN_SOL_SOCKET, NN_RCVTIMEO, &timeout, sizeof(timeout));
+
+  int bytes = comm_receive_hdr(c, &data, hdr, &hdr_size);
+  if (bytes < 0) {
+    debug("Receive failed: '%s'\n", strerror(errno));
+    return NULL;
+  }
+
+  // the header is the request id the reply echoes back
+  if (hdr_size != sizeof(uint32_t)) {
+    debug("Receive failed: no request id.\n");
+    nn_freemsg(data);
+    return NULL;
+  }
+  uint32_t tag;
+  memcpy(&tag, hdr, sizeof(uint32_t));
+  *id = ntohl(tag) & ~COMM_ID_LAST;
+
+  if (size) *size = bytes;
+  debug("Received %d bytes of data tagged %u:\n", bytes, *id);
+  if_debug { printbuf(data, bytes); }
+
+  return data;
+}
+
+/**
+ * Returns a file descriptor which polls readable when a message can be
+ * received on `c`, so that several connections can be waited on at once.
+ *
+ * @return file descriptor on success, < 0 on error
+ */
+int comm_receive_fd(comm *c) {
+  int fd = -1;
+  size_t fd_size = sizeof(fd);
+  if (nn_getsockopt(c->sock, NN_SOL_SOCKET, NN_RCVFD, &fd, &fd_size) < 0) {
+    print_err("Failed to get receive fd: %s\n", strerror(errno));
+    return -1;
+  }
+  return fd;
+}
+
 void comm_free(comm *c, void *p) {
   UNUSED(c);
   nn_freemsg(p);
@@ -117,6 +337,59 @@ int comm_init(comm *c, int is_req) {
     print_err("Failed to open socket: %s\n", strerror(errno));
     return -errno;
   }
+
+  // replies carrying large coherence blocks go over the default 1MB limit
+  int max_size = -1;
+  nn_setsockopt(c->sock, NN_SOL_SOCKET, NN_RCVMAXSIZE, &max_size, sizeof(max_size));
+  return 0;
+}
+
+/**
+ * Init a requesting socket which can have any number of requests
+ * outstanding. It is a raw REQ socket: it talks to the REP sockets of the
+ * servers as a REQ socket does, but leaves the request ids to the caller,
+ * who matches the replies with them. Use comm_send_tagged and
+ * comm_receive_tagged on it.
+ *
+ * @returns 0 on success; -1 on failure
+ */
+int comm_init_mux(comm *c) {
+  memset(c, 0, sizeof(comm));
+  c->sock = nn_socket(AF_SP_RAW, NN_REQ);
+
+  log("nn_socket sock=%d (raw)\n", c->sock);
+  if(c->sock < 0) {
+    print_err("Failed to open socket: %s\n", strerror(errno));
+    return -errno;
+  }
+
+  int max_size = -1;
+  nn_setsockopt(c->sock, NN_SOL_SOCKET, NN_RCVMAXSIZE, &max_size, sizeof(max_size));
+  return 0;
+}
+
+/**
+ * Init a replying socket which can answer its requests in any order. It is
+ * a raw REP socket: comm_receive_data keeps the backtrace of the request
+ * it received, and comm_send_data and comm_send_msg send the reply with
+ * the backtrace kept last. To answer a request later, save the backtrace
+ * and put it back before the reply is sent.
+ *
+ * @returns 0 on success; -1 on failure
+ */
+int comm_init_mux_rep(comm *c) {
+  memset(c, 0, sizeof(comm));
+  c->sock = nn_socket(AF_SP_RAW, NN_REP);
+  c->raw = 1;
+
+  log("nn_socket sock=%d (raw)\n", c->sock);
+  if(c->sock < 0) {
+    print_err("Failed to open socket: %s\n", strerror(errno));
+    return -errno;
+  }
+
+  int max_size = -1;
+  nn_setsockopt(c->sock, NN_SOL_SOCKET, NN_RCVMAXSIZE, &max_size, sizeof(max_size));
   return 0;
 }
 
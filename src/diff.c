@@ -0,0 +1,386 @@
+/**
+ * Multiple writers for chunks allocated with DSM_CHUNK_MULTIWRITER. Nodes
+ * write to their copies of a page at the same time instead of taking the
+ * page over from each other, so unrelated data which happens to share a
+ * page (false sharing) does not bounce between the nodes.
+ *
+ * The master is the home of all pages of such a chunk and the only node
+ * to own them. The first write to a page on any other node copies the page
+ * into a twin and makes the page writable; no message is sent. At the next
+ * release the node compares the page with its twin and sends the changed
+ * bytes (a diff) to the master, which merges the diffs of all writers into
+ * its copy. Concurrent writers of the same bytes are a data race; the last
+ * diff to arrive wins.
+ *
+ * A released page leaves a write notice at the master, which tells the
+ * other nodes to drop their copies at their next acquire; see lrc.c. The
+ * home needs no diff for that; with DSM_NO_ADAPT it takes no twins and
+ * only notes which pages it wrote.
+ *
+ * Pages of write-update chunks, and pages the master found to be written
+ * by one node and read by others (see adapt.c), leave no notices. The
+ * writer (the home included) pushes its diff to the copyset of the page
+ * instead, and the readers patch their copies in place.
+ *
+ * A diff is a sequence of runs, each a dsm_diff_run followed by len bytes.
+ */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+#include "dsm.h"
+#include "dsm_internal.h"
+#include "fault.h"
+#include "fetch.h"
+#include "diff.h"
+#include "lrc.h"
+#include "adapt.h"
+
+/**
+ * Encodes the bytes of page which differ from twin. Runs hold only changed
+ * bytes: an unchanged byte next to a changed one may have been written by
+ * another node. Equal words are skipped a word at a time.
+ *
+ * @param len size of the page; a multiple of 8
+ * @param diff room for DSM_DIFF_MAX_SIZE(len) bytes
+ * @return size of the diff; 0 if the page did not change
+ */
+size_t dsm_diff_encode(const uint8_t *page, const uint8_t *twin, size_t len, uint8_t *diff) {
+  size_t size = 0;
+  size_t i = 0;
+
+  while (i < len) {
+    if (i % sizeof(uint64_t) == 0 &&
+        *(const uint64_t*)(page + i) == *(const uint64_t*)(twin + i)) {
+      i += sizeof(uint64_t);
+      continue;
+    }
+    if (page[i] == twin[i]) {
+      i++;
+      continue;
+    }
+    size_t start = i;
+    while (i < len && page[i] != twin[i])
+      i++;
+
+    dsm_diff_run run = {
+      .offset = start,
+      .len = i - start,
+    };
+    memcpy(diff + size, &run, sizeof(run));
+    memcpy(diff + size + sizeof(run), page + run.offset, run.len);
+    size += sizeof(run) + run.len;
+  }
+  return size;
+}
+
+/**
+ * Writes the runs of a diff into a page.
+ *
+ * @param len size of the page
+ * @return 0 on success; -1 if the diff does not fit the page
+ */
+int dsm_diff_apply(uint8_t *page, size_t len, const uint8_t *diff, size_t size) {
+  size_t pos = 0;
+  while (pos < size) {
+    dsm_diff_run run;
+    if (size - pos < sizeof(run))
+      return -1;
+    memcpy(&run, diff + pos, sizeof(run));
+    pos += sizeof(run);
+    if (run.len > size - pos || run.offset > len || run.len > len - run.offset)
+      return -1;
+    memcpy(page + run.offset, diff + pos, run.len);
+    pos += run.len;
+  }
+  return 0;
+}
+
+/**
+ * Keeps a copy of the page as it was before this node wrote to it. On a
+ * home without twins only marks the page as written. Call with the page
+ * claimed or locked, before the page becomes writable. A page which still
+ * has its twin (see dsm_diff_protect) keeps it.
+ *
+ * @param data current contents of the page
+ */
+void dsm_twin_page(dsm_chunk_meta *chunk_meta, dhandle page_offset, const uint8_t *data) {
+  if (dsm_chunk_page(chunk_meta, page_offset)->twinned)
+    return;
+  if (chunk_meta->g_twin_ptr != NULL)
+    memcpy(chunk_meta->g_twin_ptr + page_offset*chunk_meta->block_size, data,
+        chunk_meta->block_size);
+  dsm_chunk_page(chunk_meta, page_offset)->twinned = 1;
+}
+
+/**
+ * Waits until no fault is moving the page to another state and claims it.
+ */
+static
+void dsm_diff_claim(dsm_page_meta *page_meta) {
+  uint32_t seq = page_meta->fetch_seq;
+  while (!__sync_bool_compare_and_swap(&page_meta->fetch_state, 0,
+        DSM_FETCH_CLAIMED | DSM_FETCH_SENT)) {
+    dsm_fetch_wait(page_meta, seq);
+    seq = page_meta->fetch_seq;
+  }
+}
+
+/**
+ * Returns the nodes other than writer and the master with a copy of a
+ * page. Executes on the master.
+ */
+uint64_t dsm_diff_copyset(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t writer) {
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  return page_meta->copyset & ~(1ULL << d->c.master_idx) & ~(1ULL << writer);
+}
+
+/**
+ * Takes the nodes other than writer and the master out of the copyset of
+ * a page. They drop their copies at their next acquire, on the write
+ * notice left for the write. Executes on the master with the page locked.
+ */
+void dsm_diff_forget(dsm *d, dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t writer) {
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  page_meta->copyset &= (1ULL << d->c.master_idx) | (1ULL << writer);
+}
+
+/**
+ * Applies a diff of another node to this node's copy of a page, and to
+ * its twin so that the bytes do not show up in the diff of this node.
+ * Pages not mapped here are left alone.
+ *
+ * A read-only page is never writable to the application meanwhile; it is
+ * patched through the alias, or replaced as a whole.
+ *
+ * This runs on the daemon, which must not wait for a fetch: the fetch may
+ * in turn wait for a daemon waiting for this one. A page being fetched is
+ * dropped instead, since the reply may predate the diff; the access
+ * faults again and gets the merged page from the home.
+ *
+ * @return 0 on success; -1 if the diff does not fit the page
+ */
+int dsm_diff_patch(dsm *d, dhandle chunk_id, dhandle page_offset, const uint8_t *diff, uint32_t size) {
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  size_t len = chunk_meta->block_size;
+  uint8_t *page = (uint8_t*)chunk_meta->g_base_ptr + page_offset*len;
+  int error = 0;
+
+  // other claims are held without waiting for anybody
+  while (!__sync_bool_compare_and_swap(&page_meta->fetch_state, 0,
+        DSM_FETCH_CLAIMED | DSM_FETCH_SENT)) {
+    if (!(page_meta->fetch_state & DSM_FETCH_REMOTE)) {
+      sched_yield();
+      continue;
+    }
+    dsm_page_lock(page_meta);
+    if (page_meta->fetch_state & DSM_FETCH_REMOTE) {
+      page_meta->page_prot = PROT_NONE;
+      page_meta->inval_seq++;
+      __sync_fetch_and_or(&page_meta->fetch_state, DSM_FETCH_STALE);
+      dsm_page_unlock(page_meta);
+      return 0;
+    }
+    dsm_page_unlock(page_meta);
+  }
+
+  dsm_page_lock(page_meta);
+  if (page_meta->page_prot == PROT_NONE)
+    goto cleanup_unlock;
+
+  if (page_meta->twinned && chunk_meta->g_twin_ptr != NULL &&
+      (error = dsm_diff_apply((uint8_t*)chunk_meta->g_twin_ptr + page_offset*len, len, diff, size)) < 0)
+    goto cleanup_unlock;
+
+  if (chunk_meta->g_alias_ptr != NULL) {
+    error = dsm_diff_apply((uint8_t*)chunk_meta->g_alias_ptr + page_offset*len, len, diff, size);
+  } else if (page_meta->page_prot == PROT_WRITE) {
+    error = dsm_diff_apply(page, len, diff, size);
+  } else {
+    // accesses fault meanwhile and wait for the claim
+    uint8_t *buf = (uint8_t*)malloc(len);
+    if (buf == NULL) {
+      error = -1;
+      goto cleanup_unlock;
+    }
+    memcpy(buf, page, len);
+    if ((error = dsm_diff_apply(buf, len, diff, size)) == 0 &&
+        (error = dsm_page_protect(chunk_meta, page_offset, PROT_NONE)) == 0)
+      error = dsm_page_install(chunk_meta, page_offset, buf, PROT_READ);
+    free(buf);
+  }
+cleanup_unlock:
+  dsm_page_unlock(page_meta);
+  dsm_fetch_release(chunk_meta, page_offset);
+  return error;
+}
+
+/**
+ * Sends the changes of a page written since its twin was taken to the
+ * master, and to the copyset of a write-update page. Optionally drops
+ * the local copy. On a home without twins only leaves a write notice.
+ *
+ * @param diff room for DSM_DIFF_MAX_SIZE(block_size) bytes
+ * @param invalidate 1 to drop the page afterwards
+ * @return 0 on success; -1 in case of error
+ */
+static
+int dsm_diff_page(dsm *d, dhandle chunk_id, dhandle page_offset, uint8_t *diff, int invalidate) {
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  size_t len = chunk_meta->block_size;
+  size_t size = 0;
+  int error = 0;
+
+  pthread_mutex_lock(&d->lrc.diff_lock);
+  dsm_diff_claim(page_meta);
+  dsm_page_lock(page_meta);
+  if (page_meta->twinned) {
+    // later writes fault again and take a new twin. A flush may have
+    // write-protected the page already
+    if (page_meta->page_prot == PROT_WRITE &&
+        (error = dsm_page_protect(chunk_meta, page_offset, PROT_READ)) < 0)
+      goto cleanup_unlock;
+    page_meta->page_prot = PROT_READ;
+    page_meta->twinned = 0;
+    if (d->is_master)
+      dsm_adapt_write(d, chunk_meta, page_offset, d->c.this_node_idx);
+    if (d->is_master && !dsm_adapt_update(d, chunk_meta, page_offset)) {
+      dsm_diff_forget(d, chunk_meta, page_offset, d->c.this_node_idx);
+      error = dsm_lrc_log(d, d->c.this_node_idx, chunk_id, page_offset);
+    } else {
+      size = dsm_diff_encode((uint8_t*)chunk_meta->g_base_ptr + page_offset*len,
+          (uint8_t*)chunk_meta->g_twin_ptr + page_offset*len, len, diff);
+      madvise(chunk_meta->g_twin_ptr + page_offset*len, len, MADV_DONTNEED);
+    }
+  }
+  if (invalidate && page_meta->page_prot != PROT_NONE)
+    error = dsm_page_invalidate(chunk_meta, page_offset);
+  // a dropped page is not fetched again before the home has the diff.
+  // Updates meanwhile find it waiting for the home and leave it alone
+  if (invalidate)
+    __sync_fetch_and_or(&page_meta->fetch_state, DSM_FETCH_REMOTE);
+cleanup_unlock:
+  dsm_page_unlock(page_meta);
+  if (!invalidate)
+    dsm_fetch_release(chunk_meta, page_offset);
+
+  // sent without a claim the daemons of the receivers would wait for;
+  // d->lrc.diff_lock keeps the diffs of a page in order instead
+  if (size > 0) {
+    uint64_t copyset = 0;
+    if (d->is_master)
+      copyset = dsm_diff_copyset(d, chunk_meta, page_offset, d->c.this_node_idx);
+    else if (dsm_request_pagediff(d->master, chunk_id, page_offset,
+          d->c.this_node_idx, diff, size, &copyset) < 0)
+      error = -1;
+    for (int i = 0; copyset != 0; i++, copyset >>= 1) {
+      if (!(copyset & 1))
+        continue;
+      if (dsm_request_pageupdate(&d->clients[i], chunk_id, page_offset,
+            d->c.this_node_idx, diff, size) < 0)
+        error = -1;
+      chunk_meta->updates_pushed++;
+    }
+    chunk_meta->diffs_sent++;
+    chunk_meta->diff_bytes += size;
+  }
+  if (invalidate)
+    dsm_fetch_release(chunk_meta, page_offset);
+  pthread_mutex_unlock(&d->lrc.diff_lock);
+  return error;
+}
+
+/**
+ * Write-protects the twinned pages in [start, end) with one protection
+ * change for each run of them, so that a release does not change the
+ * pages one at a time. Writes after this fault and go on with the twin
+ * the page has; the diff then carries them too.
+ */
+static
+void dsm_diff_protect(dsm_chunk_meta *chunk_meta, dhandle start, dhandle end) {
+  dhandle i, run = start;
+
+  for (i = start; i < end; i++)
+    dsm_page_lock(dsm_chunk_page(chunk_meta, i));
+  for (i = start; i <= end; i++) {
+    dsm_page_meta *page_meta = i < end ? dsm_chunk_page(chunk_meta, i) : NULL;
+    if (page_meta != NULL && page_meta->twinned && page_meta->page_prot == PROT_WRITE)
+      continue;
+    if (i > run && dsm_pages_protect(chunk_meta, run, i - run, PROT_READ) == 0) {
+      for (dhandle j = run; j < i; j++)
+        dsm_chunk_page(chunk_meta, j)->page_prot = PROT_READ;
+    }
+    run = i + 1;
+  }
+  for (i = start; i < end; i++)
+    dsm_page_unlock(dsm_chunk_page(chunk_meta, i));
+}
+
+/**
+ * Sends the diffs of all pages of the chunk written on this node to
+ * the master. Called on release and before the chunk is freed.
+ *
+ * @param d dsm object
+ * @param chunk_id chunk; nothing is done unless it is a multiple-writer chunk
+ * @return 0 on success; -1 if a diff could not be sent
+ */
+int dsm_diff_flush(dsm *d, dhandle chunk_id) {
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  int error = 0;
+
+  if (!(chunk_meta->flags & DSM_CHUNK_MULTIWRITER) || chunk_meta->count == 0)
+    return 0;
+
+  uint8_t *diff = (uint8_t*)malloc(DSM_DIFF_MAX_SIZE(chunk_meta->block_size));
+  if (diff == NULL)
+    return -1;
+  // write-protect the written pages first, a run of them at a time
+  dsm_page_meta *page_meta;
+  for (dhandle start = 0, end; start < chunk_meta->count; start = end + 1) {
+    for (end = start; end < chunk_meta->count &&
+        (page_meta = dsm_chunk_page_peek(chunk_meta, end)) != NULL && page_meta->twinned; end++);
+    if (end > start)
+      dsm_diff_protect(chunk_meta, start, end);
+  }
+  for (dhandle i = 0; i < chunk_meta->count; i++) {
+    page_meta = dsm_chunk_page_peek(chunk_meta, i);
+    if (page_meta == NULL || !page_meta->twinned)
+      continue;
+    if (dsm_diff_page(d, chunk_id, i, diff, 0) < 0) {
+      print_err("Could not flush diff of chunk_id=%"PRIu64", page_offset=%"PRIu64"\n", chunk_id, i);
+      error = -1;
+    }
+  }
+  free(diff);
+  return error;
+}
+
+/**
+ * Drops the copy of a page on this node, which another node wrote to.
+ * Changes made here since the last release are sent to the master first.
+ *
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_diff_drop(dsm *d, dhandle chunk_id, dhandle page_offset) {
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  if (chunk_meta->g_twin_ptr == NULL || page_offset >= chunk_meta->count ||
+      dsm_chunk_page(chunk_meta, page_offset)->page_prot == PROT_NONE)
+    return 0;
+
+  uint8_t *diff = (uint8_t*)malloc(DSM_DIFF_MAX_SIZE(chunk_meta->block_size));
+  if (diff == NULL)
+    return -1;
+  int error = dsm_diff_page(d, chunk_id, page_offset, diff, 1);
+  free(diff);
+  return error;
+}
@@ -15,13 +15,15 @@
 #include "utils.h"
 #include "dsm.h"
 #include "dsm_internal.h"
+#include "fault.h"
+#include "fetch.h"
+#include "diff.h"
+#include "lrc.h"
+#include "strings.h"
 
 #define handle_error(msg) \
   do { print_err(msg); return(NULL); } while (0)
 
-#define get_page_offset(ptr, base_ptr) \
-  (ptr - base_ptr)/PAGESIZE
-
 static struct sigaction sa;
 int PAGESIZE = 4096;
 dsm *g_dsm;
@@ -37,35 +39,14 @@ void sigterm_handler(int sig) {
   UNUSED(sig);
   log("Got sigterm. Terminating server.\n");
   g_dsm->s.terminated = 1;
-}
-
-/**
- * Utility function which returns the chunk to which the addr belongs
- *
- * @param saddr addr from the signal
- */
-static 
-dhandle get_chunk_id_for_addr(char *saddr) {
-  dhandle i;
-  char *base_ptr;
-  size_t chunk_size;
-
-  for (i=0; i<NUM_CHUNKS; i++) {
-    dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[i];
-    base_ptr = chunk_meta->g_base_ptr;
-    chunk_size = chunk_meta->g_chunk_size;
-    if (saddr >= base_ptr && saddr < base_ptr + chunk_size)
-      return i; 
-  }
-  return NUM_CHUNKS;
+  g_dsm->peer.terminated = 1;
+  g_dsm->delivery.terminated = 1;
 }
 
 static 
 void *dsm_daemon_start(void *ptr) {
-  dsm *d = (dsm*)ptr;
-  log("Starting server on port %d\n", d->port);
-  dsm_server *s = &d->s;
-  dsm_server_init(s, "localhost", d->port);
+  dsm_server *s = (dsm_server*)ptr;
+  log("Starting server on port %d\n", s->port);
   dsm_server_start(s);
   return 0;
 }
@@ -75,9 +56,7 @@ void *dsm_daemon_start(void *ptr) {
  * Everything in this function should be re-entrant and asynchronous. Curiously, 
  * even printfs are not allowed; so do not add logs in this function. 
  * 
- * TODO remove log statements from this function
- *
- * TODO remove synchronous getpage calls
+ * The page is fetched by the fetch thread; the handler only parks on a futex.
  *
  * Refer to the signal man page to get the list of functions allowed in this function. 
  *
@@ -88,36 +67,7 @@ void *dsm_daemon_start(void *ptr) {
 static 
 void dsm_sigsegv_handler(int sig, siginfo_t *si, void *ctxt) {
   UNUSED(sig);
-  UNUSED(si);
-  UNUSED(ctxt);
   int write_fault = 0;
-  uint32_t flags = 0;
-
-  // get the chunk meta for this addr
-  dhandle chunk_id; 
-  if ((chunk_id = get_chunk_id_for_addr((char*)si->si_addr)) == NUM_CHUNKS) {
-    print_err("Wrong chunk id for addr: 0x%lx chunk_id: %"PRIu64"\n",
-        (long) si->si_addr, chunk_id);
-    return;
-  }
-
-  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
-  char *base_ptr = chunk_meta->g_base_ptr;
-  size_t chunk_size = chunk_meta->g_chunk_size;
-
-  // safety check; probably not necessary
-  // TODO remove this later
-  if ((char*)si->si_addr < base_ptr || 
-      (char*)si->si_addr >= base_ptr + chunk_size) {
-    print_err("Fault out of chunk. address: 0x%lx chunk_id: %"PRIu64" base_ptr: %p base_end: %p\n",
-        (long) si->si_addr, chunk_id, base_ptr, base_ptr + chunk_size);
-    return;
-  }
-  
-  // Build page offset
-  dhandle page_offset = (dhandle)get_page_offset((char *)(si->si_addr), base_ptr);
-  dsm_page_meta *page_meta = &chunk_meta->pages[page_offset];
-  char *page_start_addr = base_ptr + PAGESIZE*page_offset;
 
   // this works on x86_64 GNU/Linux 
   if (((ucontext_t*)ctxt)->uc_mcontext.gregs[REG_ERR] & 0x2) {
@@ -126,50 +76,7 @@ void dsm_sigsegv_handler(int sig, siginfo_t *si, void *ctxt) {
     write_fault = 0;
   }
 
-#ifdef _DSM_STATS
-  if (write_fault)
-    page_meta->num_write_faults++;
-  else
-    page_meta->num_read_faults++;
-#endif
-
-  // Use a state transition table for this later?
-  if (page_meta->page_prot == PROT_NONE) {
-    if (write_fault) {
-      flags |= FLAG_PAGE_WRITE;
-      page_meta->page_prot = PROT_WRITE;
-    } else {
-      flags |= FLAG_PAGE_READ;
-      page_meta->page_prot = PROT_READ;
-    }
-  } else if (page_meta->page_prot == PROT_READ) {
-    flags |= FLAG_PAGE_WRITE;
-    page_meta->page_prot = PROT_WRITE;
-  }
- 
-  // Request page from master
-  dsm_request *r = g_dsm->master;
-  if (dsm_request_getpage(r, chunk_id, page_offset, 
-        g_dsm->host, g_dsm->port, &g_dsm->page_buffer, flags) < 0) {
-    //TODO: we have not yet decided on what to do if page is not found;
-    print_err("getpage failed\n");
-  }
-  
-  // temporarily set the protection to READ/WRITE to update the page
-  if (mprotect(page_start_addr, PAGESIZE, PROT_READ | PROT_WRITE) == -1)
-    print_err("mprotect\n");
-  
-  // copy the page
-  if (!(flags & FLAG_PAGE_NOUPDATE)) {
-    memcpy(page_start_addr, g_dsm->page_buffer, PAGESIZE);
-  }
-
-  // reset protection back to read if it is just read fault
-  if (!write_fault) {
-    if (mprotect(page_start_addr, PAGESIZE, PROT_READ) == -1)
-      print_err("mprotect\n");
-  }
-  page_meta->nodes_reading[g_dsm->c.this_node_idx] = 1;
+  dsm_fault_handle(g_dsm, (char*)si->si_addr, write_fault, 1);
 }
 
 
@@ -187,71 +94,74 @@ void dsm_sigsegv_handler(int sig, siginfo_t *si, void *ctxt) {
  * @return pointer to the shared memory chunk; NULL in case of error
  */
 void *dsm_alloc(dsm *d, dhandle chunk_id, ssize_t chunk_size) {
-  uint32_t i;
+  return dsm_alloc_ex(d, chunk_id, chunk_size, 0, 0);
+}
 
-  // register signal handler for the chunk
-  sa.sa_flags = SA_SIGINFO;
-  sigemptyset(&sa.sa_mask);
-  sa.sa_sigaction = dsm_sigsegv_handler;
-  if (sigaction(SIGSEGV, &sa, NULL) == -1) {
-    handle_error("sigaction");
-  }
+void *dsm_alloc_ex(dsm *d, dhandle chunk_id, ssize_t chunk_size, size_t block_size, int flags) {
+  uint32_t i;
 
-  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
-  memset((void*)chunk_meta, 0, sizeof(dsm_chunk_meta));
-  
   // get page size
   PAGESIZE = sysconf(_SC_PAGE_SIZE);
   if (PAGESIZE == -1)
     handle_error("sysconf");
   debug("---------- PAGESIZE: %d\n", PAGESIZE);
-  
-  // initialize chunk related data structures
-  uint32_t num_pages = 1 + (chunk_size-1)/PAGESIZE;
-  chunk_meta->g_chunk_size = chunk_size = num_pages * PAGESIZE;
-  log("Num pages alloc'ed for chunk %"PRIu64": %d\n", chunk_id, num_pages);
-
-  // allocate chunk memory
-  void *base_ptr = chunk_meta->g_base_ptr = memalign(PAGESIZE, num_pages*PAGESIZE);
-  if (base_ptr == NULL)
-    handle_error("memalign\n");
-  memset(base_ptr, 0, chunk_size);
-
-  if (!d->is_master) {
-    // for master this is allocated in the internal function
-    chunk_meta->pages = (dsm_page_meta*)calloc(num_pages, sizeof(dsm_page_meta));
-    for (i = 0; i < num_pages; i++) {
-      if (pthread_mutex_init(&chunk_meta->pages[i].lock, NULL) != 0) {
-        handle_error("mutex init failed\n");
-      }
+
+  if (block_size == 0)
+    block_size = PAGESIZE;
+  if (block_size % PAGESIZE != 0 || (block_size & (block_size - 1)) != 0 ||
+      block_size > UINT32_MAX) {
+    print_err("Invalid block size %zu for chunk %"PRIu64"\n", block_size, chunk_id);
+    return NULL;
+  }
+  if (chunk_size <= 0) {
+    print_err("Invalid size %zd for chunk %"PRIu64"\n", chunk_size, chunk_id);
+    return NULL;
+  }
+
+  // register signal handler for the chunk
+  if (d->fault_mode == DSM_FAULT_SIGSEGV) {
+    sa.sa_flags = SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_sigaction = dsm_sigsegv_handler;
+    if (sigaction(SIGSEGV, &sa, NULL) == -1) {
+      handle_error("sigaction");
     }
   }
- 
-  int is_owner = 0;
-  // synchronously inform the master about the memory allocation
-  // When a request for a page comes from other nodes;
-  //   master will get the chunk_meta, page_meta for the request and
-  //   return the page
-  if ( (is_owner = dsm_request_allocchunk(d->master, chunk_id, chunk_size, d->host, d->port)) < 0) {
-    handle_error("allocchunk failed\n");
+
+  if (flags & DSM_CHUNK_WRITEUPDATE)
+    flags |= DSM_CHUNK_MULTIWRITER;
+  if ((flags & DSM_CHUNK_MULTIWRITER) && (flags & DSM_CHUNK_DYNAMIC)) {
+    print_err("Chunk %"PRIu64" can not be both multiple-writer and dynamic\n", chunk_id);
+    return NULL;
   }
-  printf("Allocchunk success. I am the owner?  %s.\n", 
-      is_owner==1?"Yes.":"No."); 
 
-  if(is_owner) {
-    if (mprotect(base_ptr, chunk_size, PROT_READ | PROT_WRITE) == -1)
-      handle_error("mprotect\n");
-    for (i = 0; i < num_pages; i++)
-      chunk_meta->pages[i].page_prot = PROT_WRITE;
+  if (chunk_id >= NUM_CHUNKS || (size_t)chunk_size > ((size_t)1 << DSM_CHUNK_SHIFT)) {
+    print_err("Chunk %"PRIu64" of size %zd does not fit in the arena\n", chunk_id, chunk_size);
+    return NULL;
+  }
 
-  } else {
-    log("prot none %p, %zu\n", base_ptr, chunk_size); 
-    if (mprotect(base_ptr, chunk_size, PROT_NONE) == -1)
-      handle_error("mprotect\n");
-    for (i = 0; i < num_pages; i++)
-      chunk_meta->pages[i].page_prot = PROT_NONE;
+  // round up to whole blocks; as blocks are powers of two no larger than
+  // the room of a chunk, the rounded size still fits
+  dhandle num_pages = 1 + ((size_t)chunk_size - 1)/block_size;
+  chunk_size = (size_t)num_pages * block_size;
+  log("Num pages alloc'ed for chunk %"PRIu64": %"PRIu64"\n", chunk_id, num_pages);
+
+  // synchronously inform the master about the memory allocation. It
+  // replies with the owner of the pages, which every node is told about
+  // next; each one manages some of the pages and sets the chunk up
+  int owner_idx;
+  if ((owner_idx = dsm_request_allocchunk(d->master, chunk_id, chunk_size, block_size,
+          flags, -1, d->host, d->port)) < 0) {
+    handle_error("allocchunk failed\n");
   }
-  return base_ptr;
+  for (i = 0; i < (uint32_t)d->c.num_nodes; i++) {
+    if (dsm_request_allocchunk(&d->clients[i], chunk_id, chunk_size, block_size,
+          flags, owner_idx, d->host, d->port) < 0)
+      handle_error("allocchunk failed\n");
+  }
+  printf("Allocchunk success. I am the owner?  %s.\n", 
+      owner_idx == d->c.this_node_idx ? "Yes." : "No."); 
+  return d->g_dsm_page_map[chunk_id].g_base_ptr;
 }
 
 void dsm_free(dsm *d, dhandle chunk_id) {
@@ -260,44 +170,234 @@ void dsm_free(dsm *d, dhandle chunk_id) {
   dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
   if (chunk_meta->count != 0) {
     printf("----Chunk: %"PRIu64"----\n", chunk_id);
+    printf("  Prefetched pages read-ahead/stride = %"PRIu64"/%"PRIu64", stride hits/misses = %"PRIu64"/%"PRIu64"\n",
+        chunk_meta->readahead_pages, chunk_meta->stride_pages,
+        chunk_meta->stride_hits, chunk_meta->stride_misses);
+    printf("  Coalesced faults = %"PRIu64", upgraded fetches = %"PRIu64"\n",
+        chunk_meta->fetches_coalesced, chunk_meta->fetches_upgraded);
+    printf("  Diffs sent = %"PRIu64", diff bytes = %"PRIu64"\n",
+        chunk_meta->diffs_sent, chunk_meta->diff_bytes);
+    printf("  Sharing switches = %"PRIu64", exclusive grants = %"PRIu64", silent upgrades = %"PRIu64", updates pushed = %"PRIu64", redirects = %"PRIu64"\n",
+        chunk_meta->sharing_switches, chunk_meta->exclusive_grants,
+        chunk_meta->silent_upgrades, chunk_meta->updates_pushed, chunk_meta->redirects);
+    printf("  Invalidations avoided = %"PRIu64"\n", chunk_meta->invalidations_avoided);
+    printf("  Protection changes = %"PRIu64", pages changed = %"PRIu64"\n",
+        chunk_meta->protect_calls, chunk_meta->protect_pages);
     for (j = 0; j < chunk_meta->count; j++) {
-      dsm_page_meta *page_meta = &chunk_meta->pages[j];
-      printf("  Page %"PRIu64" read/write faults = %d/%d\n", j, 
+      dsm_page_meta *page_meta = dsm_chunk_page_peek(chunk_meta, j);
+      if (page_meta == NULL)
+        continue;
+      printf("  Page %"PRIu64" read/write faults = %d/%d, %s\n", j, 
           page_meta->num_read_faults, 
-          page_meta->num_write_faults);
+          page_meta->num_write_faults,
+          strsharing(dsm_chunk_sharing(chunk_meta, j)->ad_class));
     }
   }
 #endif
+  // writes to a multiple-writer chunk are only merged at the master so far.
+  // The chunk stays mapped until every node freed it
+  dsm_diff_flush(d, chunk_id);
   dsm_request_freechunk(d->master, chunk_id, d->host, d->port);
 }
 
+int dsm_get_prefetch_stats(dsm *d, dhandle chunk_id, dsm_prefetch_stats *stats) {
+  if (chunk_id >= NUM_CHUNKS || d->g_dsm_page_map[chunk_id].g_chunk_size == 0)
+    return -1;
+
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  stats->readahead_pages = chunk_meta->readahead_pages;
+  stats->stride_pages = chunk_meta->stride_pages;
+  stats->stride_hits = chunk_meta->stride_hits;
+  stats->stride_misses = chunk_meta->stride_misses;
+  return 0;
+}
+
+int dsm_get_sharing_stats(dsm *d, dhandle chunk_id, dsm_sharing_stats *stats) {
+  if (chunk_id >= NUM_CHUNKS || d->g_dsm_page_map[chunk_id].g_chunk_size == 0)
+    return -1;
+
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  memset(stats, 0, sizeof(*stats));
+  for (uint32_t i = 0; i < chunk_meta->count; i++) {
+    if ((chunk_meta->flags & DSM_CHUNK_DYNAMIC) ||
+        dsm_page_manager(d, chunk_id, i) != d->c.this_node_idx)
+      continue;
+    // pages nobody used yet are not classified
+    if (dsm_chunk_page_peek(chunk_meta, i) == NULL)
+      stats->pages[DSM_SHARING_UNKNOWN]++;
+    else
+      stats->pages[dsm_chunk_sharing(chunk_meta, i)->ad_class]++;
+  }
+  stats->switches = chunk_meta->sharing_switches;
+  stats->exclusive_grants = chunk_meta->exclusive_grants;
+  stats->silent_upgrades = chunk_meta->silent_upgrades;
+  stats->updates_pushed = chunk_meta->updates_pushed;
+  stats->redirects = chunk_meta->redirects;
+  stats->invalidations_avoided = chunk_meta->invalidations_avoided;
+  return 0;
+}
+
+int dsm_get_protect_stats(dsm *d, dhandle chunk_id, dsm_protect_stats *stats) {
+  if (chunk_id >= NUM_CHUNKS || d->g_dsm_page_map[chunk_id].g_chunk_size == 0)
+    return -1;
+
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  stats->calls = chunk_meta->protect_calls;
+  stats->pages = chunk_meta->protect_pages;
+  return 0;
+}
+
+/**
+ * Returns 1 if this node uses a multiple-writer chunk.
+ */
+static
+int dsm_has_multiwriter(dsm *d) {
+  for (int i = 0; i < NUM_CHUNKS; i++) {
+    dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[i];
+    if ((chunk_meta->flags & DSM_CHUNK_MULTIWRITER) && chunk_meta->count != 0)
+      return 1;
+  }
+  return 0;
+}
+
+int dsm_release(dsm *d) {
+  int error = 0;
+  for (int i = 0; i < NUM_CHUNKS; i++) {
+    if (dsm_diff_flush(d, i) < 0)
+      error = -1;
+  }
+  return error;
+}
+
+int dsm_acquire(dsm *d) {
+  // the master holds the home copies, which are never stale
+  if (d->is_master || !dsm_has_multiwriter(d))
+    return 0;
+  return dsm_lrc_acquire(d);
+}
+
 int dsm_barrier_all(dsm *d) {
   int i;
   dsm_conf *c = &d->c;
+  uint64_t others = 0;
+
+  // hand the writes to multiple-writer chunks to the master first
+  dsm_release(d);
+
+  // count this node in. The counter is never reset: a node may already
+  // have entered the next barrier by the time this one returns
+  pthread_mutex_lock(&d->barrier_lock);
+  uint64_t gen = ++d->barrier_gen;
+  d->barrier_counter++;
+  pthread_mutex_unlock(&d->barrier_lock);
   
-  // send barrier request to all other nodes
+  // send barrier request to all other nodes at once
   for (i = 0; i < c->num_nodes; i++) {
     if (i == c->this_node_idx) continue;
-    dsm_request_barrier(&d->clients[i]);
+    others |= 1ULL << i;
   }
+  dsm_request_barriers(d->clients, c->num_nodes, others);
 
   // wait until all nodes hit the barrier
   pthread_mutex_lock(&d->barrier_lock);
-  while (d->barrier_counter < (uint64_t)c->num_nodes) {
+  while (d->barrier_counter < gen*(uint64_t)c->num_nodes) {
     pthread_cond_wait(&d->barrier_cond, &d->barrier_lock);
   }
   pthread_mutex_unlock(&d->barrier_lock);
-  
-  // set it back to 1 and not 0
-  d->barrier_counter = 1;
+
+  // drop the copies of pages the other nodes wrote
+  return dsm_acquire(d);
+}
+
+int dsm_lock_init(dsm *d, dhandle lock_id) {
+  dsm_locks *l = &d->locks;
+  if (lock_id >= NUM_LOCKS) {
+    print_err("Invalid lock id %"PRIu64"\n", lock_id);
+    return -1;
+  }
+
+  pthread_mutex_lock(&l->lock);
+  if (!l->initialized[lock_id] && pthread_mutex_init(&l->local[lock_id], NULL) == 0)
+    l->initialized[lock_id] = 1;
+  pthread_mutex_unlock(&l->lock);
+  return l->initialized[lock_id] ? 0 : -1;
+}
+
+/**
+ * Gives a lock this node holds back to the master, and hands it to the
+ * node queued next for it, if any. The local mutex of the lock is left to
+ * the caller.
+ *
+ * @return 0 on success; -1 in case of error
+ */
+static
+int dsm_lock_pass(dsm *d, dhandle lock_id) {
+  int next_idx;
+  if ((next_idx = dsm_request_unlock(d->master, lock_id, d->c.this_node_idx)) < -1)
+    return -1;
+  if (next_idx >= 0 &&
+      dsm_request_lockgrant(&d->clients[next_idx], lock_id, d->c.this_node_idx) < 0) {
+    print_err("Could not hand lock %"PRIu64" over to node %d\n", lock_id, next_idx);
+    return -1;
+  }
   return 0;
 }
 
-int dsm_init(dsm *d, const char* host, uint32_t port, int is_master) {
+int dsm_lock(dsm *d, dhandle lock_id) {
+  dsm_locks *l = &d->locks;
+  if (lock_id >= NUM_LOCKS || !l->initialized[lock_id]) {
+    print_err("Lock %"PRIu64" not initialized\n", lock_id);
+    return -1;
+  }
+
+  pthread_mutex_lock(&l->local[lock_id]);
+  l->granted[lock_id] = 0;
+
+  int granted;
+  if ((granted = dsm_request_lock(d->master, lock_id, d->c.this_node_idx)) < 0) {
+    pthread_mutex_unlock(&l->local[lock_id]);
+    return -1;
+  }
+
+  // queued; the current holder hands the lock over
+  if (!granted) {
+    pthread_mutex_lock(&l->lock);
+    while (!l->granted[lock_id])
+      pthread_cond_wait(&l->granted_cond, &l->lock);
+    pthread_mutex_unlock(&l->lock);
+  }
+
+  // the caller does not unlock a lock it failed to take
+  if (dsm_acquire(d) < 0) {
+    dsm_lock_pass(d, lock_id);
+    pthread_mutex_unlock(&l->local[lock_id]);
+    return -1;
+  }
+  return 0;
+}
+
+int dsm_unlock(dsm *d, dhandle lock_id) {
+  dsm_locks *l = &d->locks;
+  int error = 0;
+  if (lock_id >= NUM_LOCKS || !l->initialized[lock_id])
+    return -1;
+
+  if (dsm_release(d) < 0)
+    error = -1;
+
+  if (dsm_lock_pass(d, lock_id) < 0)
+    error = -1;
+  pthread_mutex_unlock(&l->local[lock_id]);
+  return error;
+}
+
+int dsm_init(dsm *d, const char* host, uint32_t port, int is_master, int flags) {
   // initialize dsm structure
   strncpy((char*)d->host, host, sizeof(d->host));
   d->port = port;
   d->is_master = is_master;
+  d->flags = flags;
+  d->fault_mode = flags & DSM_FAULT_UFFD;
 
   // catch SIGTERM to clean up
   struct sigaction act;
@@ -316,12 +416,9 @@ int dsm_init(dsm *d, const char* host, uint32_t port, int is_master) {
     return -1;
   }
 
-  // allocate page buffer
-  // this will be used to store getpage responses
-  d->page_buffer = (uint8_t*)calloc(PAGESIZE, sizeof(uint8_t));
-
   // initialize barrier variables 
-  d->barrier_counter = 1;
+  d->barrier_counter = 0;
+  d->barrier_gen = 0;
   if (pthread_mutex_init(&d->barrier_lock, NULL) != 0) {
     print_err("barrier mutex init failed\n");
     return -1;
@@ -331,19 +428,54 @@ int dsm_init(dsm *d, const char* host, uint32_t port, int is_master) {
     return -1;
   }
 
-  // initialize background thread
-  if (pthread_create(&d->dsm_daemon, NULL, &dsm_daemon_start, (void *)d) != 0) {
-    print_err("Thread not created! %d\n", -errno);
+  if (dsm_lrc_init(d) < 0)
+    return -1;
+
+  // no chunk is allocated yet
+  memset((void*)d->g_dsm_page_map, 0, sizeof(d->g_dsm_page_map));
+
+  // initialize lock service; all locks are free
+  memset(&d->locks, 0, sizeof(d->locks));
+  for (int i = 0; i < NUM_LOCKS; i++)
+    d->locks.meta[i].holder = -1;
+  if (pthread_mutex_init(&d->locks.lock, NULL) != 0 ||
+      pthread_cond_init(&d->locks.granted_cond, NULL) != 0) {
+    print_err("lock service init failed\n");
     return -1;
   }
 
+  // start the fault thread if userfaultfd is requested; other nodes may
+  // set chunks up here as soon as the background threads run
+  if (dsm_fault_init(d) < 0)
+    return -1;
+
   // open connections to other nodes
   d->clients = (dsm_request*)calloc(c->num_nodes, sizeof(dsm_request));
+  d->peers = (dsm_request*)calloc(c->num_nodes, sizeof(dsm_request));
+  d->deliveries = (dsm_request*)calloc(c->num_nodes, sizeof(dsm_request));
   for (int i = 0; i < c->num_nodes; i++) {
     dsm_request_init(&d->clients[i], c->hosts[i], c->ports[i]);
+    dsm_request_init(&d->peers[i], c->hosts[i], c->ports[i] + DSM_PEER_PORT_OFFSET);
+    dsm_request_init(&d->deliveries[i], c->hosts[i], c->ports[i] + DSM_DELIVERY_PORT_OFFSET);
   }
   d->master = &d->clients[c->master_idx];
-  return 0;
+
+  // start the servers once the handlers can use the connections above
+  dsm_server_init(&d->s, "localhost", d->port);
+  dsm_server_init(&d->peer, "localhost", d->port + DSM_PEER_PORT_OFFSET);
+  dsm_server_init(&d->delivery, "localhost", d->port + DSM_DELIVERY_PORT_OFFSET);
+  // the primary service serves faults, which may find their pages busy
+  if (dsm_server_park(&d->s) < 0)
+    return -1;
+  if (pthread_create(&d->dsm_daemon, NULL, &dsm_daemon_start, (void *)&d->s) != 0 ||
+      pthread_create(&d->peer_daemon, NULL, &dsm_daemon_start, (void *)&d->peer) != 0 ||
+      pthread_create(&d->delivery_daemon, NULL, &dsm_daemon_start, (void *)&d->delivery) != 0) {
+    print_err("Thread not created! %d\n", -errno);
+    return -1;
+  }
+
+  // start the thread fetching pages for faults
+  return dsm_fetch_init(d);
 }
     
 int dsm_close(dsm *d) {
@@ -367,17 +499,34 @@ int dsm_close(dsm *d) {
 
   log("Master approved! Shutting down.\n");
   dsm_conf *c = &d->c;
-  free(d->page_buffer);
+  dsm_fault_close(d);
+  dsm_fetch_close(d);
   
   dsm_request_terminate(&d->clients[c->this_node_idx], d->host, d->port);
+  dsm_request_terminate(&d->peers[c->this_node_idx], d->host, d->port);
+  dsm_request_terminate(&d->deliveries[c->this_node_idx], d->host, d->port);
 
   pthread_join(d->dsm_daemon, NULL); /* Wait until thread is finished */
+  pthread_join(d->peer_daemon, NULL);
+  pthread_join(d->delivery_daemon, NULL);
   pthread_cond_destroy(&d->barrier_cond);
   pthread_mutex_destroy(&d->barrier_lock);
+  dsm_lrc_close(d);
+  for (int i = 0; i < NUM_LOCKS; i++) {
+    if (d->locks.initialized[i])
+      pthread_mutex_destroy(&d->locks.local[i]);
+  }
+  pthread_cond_destroy(&d->locks.granted_cond);
+  pthread_mutex_destroy(&d->locks.lock);
   
-  for (int i = 0; i < c->num_nodes; i++)
+  for (int i = 0; i < c->num_nodes; i++) {
     dsm_request_close(&d->clients[i]);
+    dsm_request_close(&d->peers[i]);
+    dsm_request_close(&d->deliveries[i]);
+  }
   free(d->clients);
+  free(d->peers);
+  free(d->deliveries);
   dsm_conf_close(c);
   return 0;
 }
@@ -10,11 +10,24 @@
 #include <inttypes.h>
 #include <malloc.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <pthread.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
 
 #include "dsm.h"
+#include "fault.h"
+#include "fetch.h"
+#include "diff.h"
+#include "lrc.h"
+#include "adapt.h"
 #include "utils.h"
+#include "dsm_internal.h"
 
 extern dsm *g_dsm;
 
@@ -60,111 +73,288 @@ get_request_idx(dsm *d, const uint8_t *host, uint32_t port) {
   return 0;
 }
 
-static int 
-acquire_chunk_lock(dhandle chunk_id) {
-  uint32_t i;
-  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
-  for (i = 0; i < chunk_meta->count; i++) {
-    pthread_mutex_lock(&chunk_meta->pages[i].lock);
-  } 
-  return 0;
-}
-
-static int
-release_chunk_lock(dhandle chunk_id) {
-  uint32_t i;
-  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
-  for (i = 0; i < chunk_meta->count; i++) {
-    pthread_mutex_unlock(&chunk_meta->pages[i].lock);
-  } 
-  return 0;
-}
-
 static int 
 dsm_really_freechunk(dhandle chunk_id) {
   log("really freeing chunk: %"PRIu64"\n", chunk_id); 
-  uint32_t i;
   dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
   
   // free the shared memory
-  if (mprotect(chunk_meta->g_base_ptr, chunk_meta->g_chunk_size, PROT_READ | PROT_WRITE) == -1) {
-    print_err("mprotect failed for addr=%p, error=%s\n", chunk_meta->g_base_ptr, strerror(errno));
+  if (dsm_chunk_unmap(g_dsm, chunk_meta) < 0)
     return -1;
-  }
-  free(chunk_meta->g_base_ptr);
   
-  // destroy lock variables
-  log("Destroying page locks\n");
-  for (i = 0; i < chunk_meta->count; i++) {
-    if (pthread_mutex_destroy(&chunk_meta->pages[i].lock) != 0) {
-      print_err("mutex destroy failed for chunk %"PRIu64", page %"PRIu32"\n", chunk_id, i);
+  log("Freeing page meta\n");
+  for (uint32_t i = 0; chunk_meta->blocks != NULL && i < 1 + (chunk_meta->count-1)/DSM_PAGE_BLOCK; i++) {
+    if (chunk_meta->blocks[i] != NULL)
+      munmap(chunk_meta->blocks[i], sizeof(dsm_page_block));
+  }
+  free((void*)chunk_meta->blocks);
+  memset((void*)chunk_meta, 0, sizeof(dsm_chunk_meta));
+  return 0;
+}
+
+/**
+ * Returns the meta of DSM_PAGE_BLOCK pages of a chunk, setting it up on
+ * first use with the owner and protection the pages started out with. So
+ * a chunk only takes a pointer per block up front, and pages which no
+ * node uses take nothing. Called from the SIGSEGV handler as well: the
+ * block is mmap'ed, and a thread which loses the race to set it up
+ * drops its own.
+ */
+static
+dsm_page_block *dsm_chunk_block(dsm_chunk_meta *chunk_meta, dhandle block_idx) {
+  dsm_page_block *block = chunk_meta->blocks[block_idx];
+  if (block != NULL)
+    return block;
+
+  block = (dsm_page_block*)mmap(NULL, sizeof(dsm_page_block), PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (block == MAP_FAILED) {
+    print_err("page meta allocation failed, error=%s\n", strerror(errno));
+    abort();
+  }
+  for (int i = 0; i < DSM_PAGE_BLOCK; i++) {
+    block->pages[i].owner_idx = chunk_meta->owner_idx;
+    block->pages[i].page_prot = chunk_meta->prot;
+    dsm_adapt_init(&block->sharing[i]);
+  }
+
+  dsm_page_block *other = __sync_val_compare_and_swap(&chunk_meta->blocks[block_idx], NULL, block);
+  if (other != NULL) {
+    munmap(block, sizeof(dsm_page_block));
+    return other;
+  }
+  return block;
+}
+
+dsm_page_meta *dsm_chunk_page(dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  dsm_page_block *block = dsm_chunk_block(chunk_meta, page_offset / DSM_PAGE_BLOCK);
+  return &block->pages[page_offset % DSM_PAGE_BLOCK];
+}
+
+dsm_page_sharing *dsm_chunk_sharing(dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  dsm_page_block *block = dsm_chunk_block(chunk_meta, page_offset / DSM_PAGE_BLOCK);
+  return &block->sharing[page_offset % DSM_PAGE_BLOCK];
+}
+
+/**
+ * Returns the meta of a page, or NULL if no page in its block was used
+ * yet; such pages are as the chunk started out. For scans of a chunk.
+ */
+dsm_page_meta *dsm_chunk_page_peek(dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  dsm_page_block *block = chunk_meta->blocks[page_offset / DSM_PAGE_BLOCK];
+  return block == NULL ? NULL : &block->pages[page_offset % DSM_PAGE_BLOCK];
+}
+
+/**
+ * Returns the node managing a page: the node which tracks its owner and
+ * copies and serves every fault on it. Runs of DSM_MANAGER_RUN pages hash
+ * to the same node, so a prefetched window mostly has a single manager.
+ * The master, as their home, manages the pages of multiple-writer chunks.
+ */
+int dsm_page_manager(dsm *d, dhandle chunk_id, dhandle page_offset) {
+  if (d->g_dsm_page_map[chunk_id].flags & DSM_CHUNK_MULTIWRITER)
+    return d->c.master_idx;
+  uint64_t h = (chunk_id << 32 | page_offset / DSM_MANAGER_RUN) * 0x9e3779b97f4a7c15ULL;
+  return (h >> 32) % d->c.num_nodes;
+}
+
+/**
+ * Returns the node a fault on a page is sent to: its manager, or the
+ * probable owner of a page of a dynamic chunk, which has no manager.
+ */
+int dsm_page_target(dsm *d, dhandle chunk_id, dhandle page_offset) {
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  if (chunk_meta->flags & DSM_CHUNK_DYNAMIC)
+    return dsm_chunk_page(chunk_meta, page_offset)->owner_idx;
+  return dsm_page_manager(d, chunk_id, page_offset);
+}
+
+/**
+ * Takes a page for the changes of its state. Every transition goes
+ * through a CAS of the state word of the page rather than a
+ * pthread_mutex_t, which would take more room than the rest of the page
+ * meta. Besides the busy bit the word holds the node the page is held for
+ * and the mode it is held in: served to that node (DSM_PAGE_SERVE), which
+ * may keep it busy across requests to other nodes, or changed locally,
+ * which never waits for another node. A thread which finds a page changed
+ * locally yields for a while before it sleeps, as the page is released
+ * soon; otherwise it queues up on the futex of the word right away. As
+ * each release bumps the version, a thread about to sleep notices one it
+ * missed. Not recursive.
+ *
+ * @param mode DSM_PAGE_SERVE, or 0 for a local change
+ * @param holder_idx node the page is held for
+ * @param wait 0 to give a busy page up rather than wait for it
+ * @return 0 once the page is held; -1 if it is busy and wait is 0
+ */
+static
+int dsm_page_take(dsm_page_meta *page_meta, uint32_t mode, int holder_idx, int wait) {
+  uint32_t held = DSM_PAGE_BUSY | mode |
+    ((uint32_t)holder_idx << DSM_PAGE_HOLDER_SHIFT & DSM_PAGE_HOLDER_MASK);
+  int spins = DSM_PAGE_SPINS;
+  for (;;) {
+    uint32_t state = page_meta->state;
+    if (!(state & DSM_PAGE_BUSY)) {
+      if (__sync_bool_compare_and_swap(&page_meta->state, state, state | held))
+        return 0;
+      continue;
+    }
+    if (!wait)
       return -1;
+    if (!(state & DSM_PAGE_SERVE) && spins-- > 0) {
+      sched_yield();
+      continue;
     }
+    // the holder only wakes a waiter up if it finds the bit set
+    if (!(state & DSM_PAGE_WAITERS) &&
+        !__sync_bool_compare_and_swap(&page_meta->state, state, state | DSM_PAGE_WAITERS))
+      continue;
+    syscall(SYS_futex, &page_meta->state, FUTEX_WAIT_PRIVATE,
+        state | DSM_PAGE_WAITERS, NULL, NULL, 0);
+    // others may still be waiting; wake the next one up on release
+    held |= DSM_PAGE_WAITERS;
   }
-  
-  log("Freeing page meta\n");
-  chunk_meta->g_chunk_size = 0;
-  chunk_meta->count = 0;
-  free(chunk_meta->pages);
-  return 0;
 }
 
 /**
- * This function will always execute on master
- * Fetch pages owned by requestor host. This is a synchronous call 
- * We wait here until all the pages owned by requestor are fetched. 
+ * Takes a page for a local change, one which does not wait for other
+ * nodes; see dsm_page_take.
+ */
+void dsm_page_lock(dsm_page_meta *page_meta) {
+  dsm_page_take(page_meta, 0, g_dsm->c.this_node_idx, 1);
+}
+
+/**
+ * Takes a page to serve a fault of requestor_idx, which may send requests
+ * to other nodes meanwhile; see dsm_page_take.
+ */
+void dsm_page_serve(dsm_page_meta *page_meta, int requestor_idx) {
+  dsm_page_take(page_meta, DSM_PAGE_SERVE, requestor_idx, 1);
+}
+
+/**
+ * As dsm_page_serve, but gives the page up if it is busy.
+ *
+ * @return 0 once the page is held; -1 if it is busy
+ */
+int dsm_page_tryserve(dsm_page_meta *page_meta, int requestor_idx) {
+  return dsm_page_take(page_meta, DSM_PAGE_SERVE, requestor_idx, 0);
+}
+
+/**
+ * Releases a page: clears the holder and mode, bumps the version and wakes
+ * up a waiting thread, and the primary service if it parked requests for
+ * the page.
+ */
+void dsm_page_unlock(dsm_page_meta *page_meta) {
+  uint32_t state;
+  do {
+    state = page_meta->state;
+  } while (!__sync_bool_compare_and_swap(&page_meta->state, state,
+        (state & ~(DSM_PAGE_VERSION - 1)) + DSM_PAGE_VERSION));
+  if (state & DSM_PAGE_WAITERS)
+    syscall(SYS_futex, &page_meta->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  if (state & DSM_PAGE_PARKED)
+    dsm_server_wake(&g_dsm->s);
+}
+
+/**
+ * Returns 1 if the copy of a page on this node is on its way: a fetch of
+ * the page is in flight, and there was no copy here when it went out.
+ * The manager may have handed the page over to this node already, and
+ * ask it for the page, before the fetch thread got to install it.
+ */
+static
+int dsm_page_arriving(const dsm_page_meta *page_meta) {
+  return (page_meta->fetch_state & (DSM_FETCH_REMOTE | DSM_FETCH_EMPTY)) ==
+    (DSM_FETCH_REMOTE | DSM_FETCH_EMPTY);
+}
+
+/**
+ * Marks a busy page for the primary service, which parks a GETPAGE for it
+ * rather than wait: the page is released by the time the service gets to
+ * it again (see dsm_server_start). The mark and the release of the page
+ * are transitions of the same word, so the holder wakes the service up
+ * even if it releases the page right away.
+ *
+ * So is a page on its way to this node, until the fetch which brings it
+ * in releases it; unless it is this node asking, the GETPAGE being that
+ * very fetch. The fetch state is checked again after the mark, as the
+ * fetch may be done by then. Pages of dynamic chunks are not held back
+ * that way; their owners redirect instead (see dsm_getpage_internal_dynamic).
+ *
+ * @return 1 if the page is busy; 0 if it is free or does not exist
  */
-static int fetch_remotely_owned_pages(dhandle chunk_id, int requestor_idx) {
+int dsm_page_park(dhandle chunk_id, dhandle page_offset,
+    const uint8_t *requestor_host, uint32_t requestor_port) {
+  if (chunk_id >= NUM_CHUNKS)
+    return 0;
   dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
-  dhandle page_offset = 0;
-  if (requestor_idx == g_dsm->c.master_idx)
+  if (chunk_meta->g_chunk_size == 0 || page_offset >= chunk_meta->count)
     return 0;
-
-  for (page_offset = 0; page_offset < chunk_meta->count; page_offset++) {
-    dsm_page_meta *m = &chunk_meta->pages[page_offset];
-    if (requestor_idx == m->owner_idx) {
-      char *page_start_addr = chunk_meta->g_base_ptr + page_offset * PAGESIZE;
-      if (mprotect(page_start_addr, PAGESIZE, PROT_READ | PROT_WRITE) == -1) {
-        print_err("mprotect failed for addr=%p, error=%s\n", page_start_addr, strerror(errno));
-        return -1;
-      }
-      dsm_request_getpage(&g_dsm->clients[requestor_idx], chunk_id, page_offset, g_dsm->host, 
-          g_dsm->port, (uint8_t**)&page_start_addr, FLAG_PAGE_WRITE);
-      
-      // finally update the page map
-      dsm_page_meta *page_meta = &chunk_meta->pages[page_offset];
-      page_meta->page_prot = PROT_WRITE;
-      page_meta->owner_idx = g_dsm->c.this_node_idx;
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  int remote = !(chunk_meta->flags & DSM_CHUNK_DYNAMIC) &&
+    get_request_idx(g_dsm, requestor_host, requestor_port) != g_dsm->c.this_node_idx;
+  for (;;) {
+    uint32_t state = page_meta->state;
+    int arriving = remote && dsm_page_arriving(page_meta);
+    if (!(state & DSM_PAGE_BUSY) && !arriving)
+      return 0;
+    if (__sync_bool_compare_and_swap(&page_meta->state, state, state | DSM_PAGE_PARKED)) {
+      if (!(state & DSM_PAGE_BUSY) && !dsm_page_arriving(page_meta))
+        return 0;
+      if (state & DSM_PAGE_BUSY)
+        log("Parked getpage for chunk_id=%"PRIu64", page_offset=%"PRIu64", held for node %u\n",
+            chunk_id, page_offset, DSM_PAGE_HOLDER(state));
+      else
+        log("Parked getpage for chunk_id=%"PRIu64", page_offset=%"PRIu64", on its way here\n",
+            chunk_id, page_offset);
+      return 1;
     }
   }
+}
 
-  // This will tell the node that it can safely release resources.
-  // This request will reach 'MARK1' label on the requestor node
-  dsm_request_freechunk(&g_dsm->clients[requestor_idx], chunk_id, g_dsm->host, g_dsm->port);
+/**
+ * Takes the local copy of a page away. A fetch or prefetch of the page in
+ * flight on this node is not installed once it completes.
+ * The page lock should be held.
+ */
+int dsm_page_invalidate(dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  if (dsm_page_protect(chunk_meta, page_offset, PROT_NONE) < 0)
+    return -1;
+  page_meta->page_prot = PROT_NONE;
+  page_meta->copyset &= ~(1ULL << g_dsm->c.this_node_idx);
+  page_meta->exclusive = 0;
+  page_meta->dirty = 0;
+  page_meta->inval_seq++;
+  if (page_meta->fetch_state & DSM_FETCH_REMOTE)
+    __sync_fetch_and_or(&page_meta->fetch_state, DSM_FETCH_STALE);
   return 0;
 }
 
-int dsm_invalidatepage_internal(dhandle chunk_id, dhandle page_offset) {
+/**
+ * Invalidates the copy of a page on this node, as some other node is about
+ * to write to it; reads leave copies alone. For a dynamic chunk the
+ * requestor is the new owner of the page, which is what this node takes
+ * to be the owner from then on.
+ */
+int dsm_invalidatepage_internal(dhandle chunk_id, dhandle page_offset,
+    const uint8_t *requestor_host, uint32_t requestor_port) {
   dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
-  dsm_page_meta *page_meta = &chunk_meta->pages[page_offset];
-  char *base_ptr = chunk_meta->g_base_ptr;
-  char *page_start_addr = base_ptr + page_offset * PAGESIZE;
+  int error = 0;
+  if (page_offset >= chunk_meta->count)
+    return -1;
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
 
-  // Change permissions to NONE
-  // set the new owner for this page
-  // TODO read-only pages can be kept
-  
   log("Acquiring mutex lock, chunk_id: %"PRIu64", %"PRIu64"\n", chunk_id, page_offset);
-  if (mprotect(page_start_addr, PAGESIZE, PROT_NONE) == -1) {
-    print_err("mprotect failed for addr=%p, error=%s\n", page_start_addr, strerror(errno));
-    return -1;
-  }
-  pthread_mutex_lock(&page_meta->lock);
-  page_meta->page_prot = PROT_NONE;
-  page_meta->nodes_reading[g_dsm->c.this_node_idx] = 0;
-  pthread_mutex_unlock(&page_meta->lock);
+  dsm_page_lock(page_meta);
+  error = dsm_page_invalidate(chunk_meta, page_offset);
+  if (chunk_meta->flags & DSM_CHUNK_DYNAMIC)
+    page_meta->owner_idx = get_request_idx(g_dsm, requestor_host, requestor_port);
+  dsm_page_unlock(page_meta);
   log("Released lock, chunk_id: %"PRIu64", %"PRIu64"\n", chunk_id, page_offset);
-  return 0;
+  return error;
 }
 
 /**
@@ -179,58 +369,268 @@ int dsm_locatepage_internal(dhandle chunk_id,
     *owner_idx = -1;
     return -1;
   }
-  log("chunk %p, %p, page owner: %"PRIu64", %"PRIu64"\n", chunk_meta, chunk_meta->pages, chunk_id, page_offset);
-  dsm_page_meta *m = &chunk_meta->pages[page_offset];
+  log("chunk %p, page owner: %"PRIu64", %"PRIu64"\n", chunk_meta, chunk_id, page_offset);
+  dsm_page_meta *m = dsm_chunk_page(chunk_meta, page_offset);
   *owner_idx = m->owner_idx;
   return 0;
 }
 
+/**
+ * Hands the copy of this node, the owner of the page, to its manager; or
+ * with FLAG_PAGE_FORWARD, straight to the requestor, so that the page
+ * crosses the network once. The delivery service of the requestor never
+ * waits for another node. The owner keeps a read-only copy for a read.
+ */
 static
-int dsm_getpage_internal_nonmaster(dsm_chunk_meta *chunk_meta, dhandle page_offset, 
-    uint8_t **data, uint64_t *count, uint32_t flags) {
-  log("I am not the master. Take the page I have.\n");
-  int error = 0;
-  dsm_page_meta *page_meta = &chunk_meta->pages[page_offset];
+int dsm_getpage_internal_owner(dhandle chunk_id, dsm_chunk_meta *chunk_meta, dhandle page_offset,
+    int requestor_idx, uint8_t **data, uint64_t *count, uint32_t flags, uint32_t *rep_flags) {
+  log("I am not the manager. Take the page I have.\n");
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
   char *base_ptr = chunk_meta->g_base_ptr;
-  char *page_start_addr = base_ptr + page_offset*PAGESIZE;
-  memcpy(*data, page_start_addr, PAGESIZE);
-  *count = PAGESIZE; 
+  char *page_start_addr = base_ptr + page_offset*chunk_meta->block_size;
+
+  // writes to the copy fault from here on, and wait for the page lock;
+  // they would be lost after the copy is taken
+  if (page_meta->page_prot == PROT_WRITE) {
+    if (dsm_page_protect(chunk_meta, page_offset, PROT_READ) < 0)
+      return -1;
+    page_meta->page_prot = PROT_READ;
+  }
+
+  // a forwarded read is sent to the requestor from the page itself below,
+  // which stays read-only and locked until the requestor has it. Anything
+  // else takes a copy before the page may be invalidated
+  int direct = (flags & FLAG_PAGE_FORWARD) && !(flags & FLAG_PAGE_WRITE);
+  if (!direct)
+    memcpy(*data, page_start_addr, chunk_meta->block_size);
+  *count = chunk_meta->block_size;
+
+  // the manager did not see the writes to an exclusive copy
+  if (page_meta->dirty && rep_flags != NULL)
+    *rep_flags |= FLAG_PAGE_DIRTY;
+  page_meta->exclusive = 0;
+  page_meta->dirty = 0;
 
   if (flags & FLAG_PAGE_WRITE) {
     // Change permissions to NONE
     // set the new owner for this page
-    if ( (error = mprotect(page_start_addr, PAGESIZE, PROT_NONE)) == -1) {
-      print_err("mprotect failed for addr=%p, error=%s\n", page_start_addr, strerror(errno));
+    if (dsm_page_invalidate(chunk_meta, page_offset) < 0)
+      return -1;
+  }
+
+  // the requestor goes on as soon as the page is in
+  if (flags & FLAG_PAGE_FORWARD) {
+    if (dsm_request_pagedata(&g_dsm->deliveries[requestor_idx], chunk_id, page_offset,
+          flags & ~FLAG_PAGE_FORWARD, direct ? (uint8_t*)page_start_addr : *data,
+          chunk_meta->block_size) < 0)
+      return -1;
+    *count = 0;
+  }
+  return 0;
+}
+
+/**
+ * Serves a fault on a page of a dynamic chunk (Li and Hudak's dynamic
+ * distributed manager). Such a page has no manager: a fault goes to the
+ * node the faulting node takes to be the owner, its probable owner.
+ *
+ * The owner serves it. A read gets a copy and joins the copyset of the
+ * owner, which keeps the page read-only from then on. A write takes the
+ * page over along with its copyset, which the new owner invalidates.
+ *
+ * Any other node redirects the requestor to its own probable owner; as the
+ * request gets to the owner in the end, the requestor of a write is taken
+ * to be the owner right away. The dsm_daemon never waits for another node
+ * that way. A node about to take the page over (or, as the owner, to write
+ * to it) has the requestor ask it again.
+ *
+ * @param rep_flags FLAG_PAGE_REDIRECT is or'ed in if the page is not served;
+ *        NULL for a prefetched page, which is only served by the owner
+ * @param rep_owner_idx set to this node if the page is served, or else to the
+ *        node to ask instead
+ * @param copyset set to the nodes with a copy for a write
+ */
+static
+int dsm_getpage_internal_dynamic(dsm_chunk_meta *chunk_meta, dhandle page_offset,
+    int requestor_idx, uint8_t **data, uint64_t *count, uint32_t flags,
+    uint32_t *rep_flags, int32_t *rep_owner_idx, uint64_t *copyset) {
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  int this_idx = g_dsm->c.this_node_idx;
+
+  *count = 0;
+  int taking_over = (page_meta->fetch_state & DSM_FETCH_CLAIMED) &&
+    page_meta->page_prot == PROT_WRITE && requestor_idx != this_idx;
+  if (page_meta->owner_idx != this_idx || taking_over) {
+    if (rep_flags == NULL)
       return -1;
+    *rep_flags |= FLAG_PAGE_REDIRECT;
+    *rep_owner_idx = taking_over ? this_idx : page_meta->owner_idx;
+    if ((flags & FLAG_PAGE_WRITE) && !taking_over && requestor_idx != this_idx)
+      page_meta->owner_idx = requestor_idx;
+    return 0;
+  }
+
+  char *page_start_addr = chunk_meta->g_base_ptr + page_offset*chunk_meta->block_size;
+  memcpy(*data, page_start_addr, chunk_meta->block_size);
+  *count = chunk_meta->block_size;
+  if (rep_owner_idx != NULL)
+    *rep_owner_idx = this_idx;
+
+  if (flags & FLAG_PAGE_WRITE) {
+    // the copyset goes with the page
+    *copyset |= page_meta->copyset & ~(1ULL << requestor_idx) & ~(1ULL << this_idx);
+    page_meta->copyset &= 1ULL << this_idx;
+    if (requestor_idx != this_idx) {
+      if (dsm_page_invalidate(chunk_meta, page_offset) < 0)
+        return -1;
+      page_meta->owner_idx = requestor_idx;
     }
-    page_meta->page_prot = PROT_NONE;
-    page_meta->nodes_reading[g_dsm->c.this_node_idx] = 0;
+    return 0;
+  }
+
+  page_meta->copyset |= 1ULL << requestor_idx;
+  if (page_meta->page_prot == PROT_WRITE) {
+    if (dsm_page_protect(chunk_meta, page_offset, PROT_READ) < 0)
+      return -1;
+    page_meta->page_prot = PROT_READ;
   }
   return 0;
 }
 
 /**
- * This function could be called from dsm_daemon thread and the main thread
+ * Returns 1 if a node other than the owner of a page and the requestor
+ * has a copy of it. The manager of the page knows of all copies.
+ */
+static
+int dsm_page_replicated(dsm_page_meta *page_meta, int requestor_idx) {
+  return (page_meta->copyset & ~(1ULL << requestor_idx) &
+      ~(1ULL << page_meta->owner_idx)) != 0;
+}
+
+/**
+ * Invalidates the copies of a page its manager hands over for writing:
+ * the copyset of the page and the copy of its owner, but for the
+ * requestor and skip_idx. The other nodes using the chunk have no copy
+ * of the page and are left alone. The copies are invalidated all at once
+ * (see dsm_request_invalidatepages). The page lock should be held.
+ *
+ * @return 0 on success; -1 if a copy could not be invalidated
+ */
+static
+int dsm_page_invalidate_copies(dhandle chunk_id, dhandle page_offset,
+    int requestor_idx, int skip_idx, uint32_t flags) {
+  dsm_conf *c = &g_dsm->c;
+  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  uint64_t targets = 0;
+
+  for (int i = 0; i < c->num_nodes; i++) {
+    // Continue for requester host and request port
+    if (i == requestor_idx || i == skip_idx)
+      continue;
+
+    // the manager invalidates its own copy locally; a read-only copy
+    // left here would be served to later readers
+    if (i == c->this_node_idx) {
+      if (page_meta->page_prot != PROT_NONE &&
+          dsm_page_invalidate(chunk_meta, page_offset) < 0)
+        return -1;
+      continue;
+    }
+
+    // send invalidate to only those clients which have a copy
+    if (!chunk_meta->clients_using[i])
+      continue;
+    if (!(page_meta->copyset & (1ULL << i)) && page_meta->owner_idx != i) {
+      __sync_fetch_and_add(&chunk_meta->invalidations_avoided, 1);
+      continue;
+    }
+    targets |= 1ULL << i;
+  }
+  // a node which did not ack may still read its stale copy; the page can
+  // not change hands then
+  return dsm_request_invalidatepages(g_dsm->peers, c->num_nodes, targets, chunk_id,
+      page_offset, g_dsm->host, g_dsm->port, flags);
+}
+
+/**
+ * Serves a fault on a page this node manages, with its own copy or the
+ * one of the owner. Called on another node, which the manager took to
+ * be the owner, it hands over the copy of that node instead.
+ *
+ * The requests to other nodes go to their peer services, whose handlers
+ * never wait for another node; the dsm_daemon of two managers could
+ * otherwise wait for each other.
+ *
+ * The manager keeps track of the copies of its pages. A read adds a copy,
+ * and the owner keeps its own one read-only; only a write invalidates the
+ * copies. A write to a copy which is still valid (FLAG_PAGE_NOUPDATE in
+ * the request) takes the page over without the data.
+ *
+ * A read may be served with the only copy of the page, depending on how
+ * the page is shared (see adapt.c); never if other nodes have a copy.
+ *
+ * The owner sends a page the manager has no copy of straight to the
+ * requestor (three hops rather than four, and the page crosses the
+ * network once). The manager only replies with FLAG_PAGE_FORWARD once the
+ * page is in; the copies of other nodes are invalidated before it is, as
+ * the requestor may write to it right away. Prefetched pages still come
+ * through the manager, which keeps a copy of them.
+ *
+ * Pages of dynamic chunks have no manager; see dsm_getpage_internal_dynamic.
+ *
+ * @param rep_flags FLAG_PAGE_EXCLUSIVE, FLAG_PAGE_DIRTY, FLAG_PAGE_FORWARD or
+ *        FLAG_PAGE_NOUPDATE are or'ed in; NULL for a prefetched page, which
+ *        is never served exclusively and not waited for if busy
+ * @param rep_owner_idx, copyset see dsm_getpage_internal_dynamic; NULL for a
+ *        prefetched page
  */
 int dsm_getpage_internal(dhandle chunk_id, dhandle page_offset,
     uint8_t *requestor_host, uint32_t requestor_port, /*these are needed for updating the page map*/
-    uint8_t **data, uint64_t *count, uint32_t flags) {
+    uint8_t **data, uint64_t *count, uint32_t flags, uint32_t *rep_flags,
+    int32_t *rep_owner_idx, uint64_t *copyset) {
   UNUSED(chunk_id);
   UNUSED(flags);
 
   int error = 0;
   dsm_conf *c = &g_dsm->c;
   dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
-  dsm_page_meta *page_meta = &chunk_meta->pages[page_offset];
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
   
+  int requestor_idx = get_request_idx(g_dsm, requestor_host, requestor_port);
   log("Acquiring mutex lock, chunk_id: %"PRIu64", %"PRIu64"\n", chunk_id, page_offset);
-  pthread_mutex_lock(&page_meta->lock);
+  // a prefetched page is not worth waiting for, nor one on its way here
+  if (rep_flags != NULL) {
+    dsm_page_serve(page_meta, requestor_idx);
+  } else if (dsm_page_tryserve(page_meta, requestor_idx) < 0) {
+    return -1;
+  } else if (dsm_page_arriving(page_meta)) {
+    dsm_page_unlock(page_meta);
+    return -1;
+  }
   
   char *base_ptr = chunk_meta->g_base_ptr;
-  if (!g_dsm->is_master) {
-    error = dsm_getpage_internal_nonmaster(chunk_meta, page_offset, data, count, flags);
+  if (chunk_meta->flags & DSM_CHUNK_DYNAMIC) {
+    error = dsm_getpage_internal_dynamic(chunk_meta, page_offset, requestor_idx,
+        data, count, flags, rep_flags, rep_owner_idx, copyset);
+    goto cleanup_unlock;
+  }
+  if (dsm_page_manager(g_dsm, chunk_id, page_offset) != c->this_node_idx) {
+    error = dsm_getpage_internal_owner(chunk_id, chunk_meta, page_offset, requestor_idx,
+        data, count, flags, rep_flags);
     goto cleanup_unlock;
   }
+
+  int exclusive = 0;
+  if (rep_flags != NULL && (flags & FLAG_PAGE_READ) &&
+      !dsm_page_replicated(page_meta, requestor_idx) &&
+      dsm_adapt_exclusive(g_dsm, chunk_meta, page_offset)) {
+    // served like a write, with the other copies invalidated
+    flags = (flags & ~FLAG_PAGE_READ) | FLAG_PAGE_WRITE;
+    *rep_flags |= FLAG_PAGE_EXCLUSIVE;
+    __sync_fetch_and_add(&chunk_meta->exclusive_grants, 1);
+    exclusive = 1;
+  }
   
   int owner_idx = 0;
   if ((error=dsm_locatepage_internal(chunk_id, page_offset, 
@@ -240,151 +640,453 @@ int dsm_getpage_internal(dhandle chunk_id, dhandle page_offset,
   }
   log("Located owner for the page %d\n", owner_idx);
    
-  int requestor_idx = get_request_idx(g_dsm, requestor_host, requestor_port);
-  *count = PAGESIZE; 
+  *count = chunk_meta->block_size;
+  uint32_t owner_flags = 0;
+  int forward = 0;
+  int taken_idx = -1;   // the owner, if it gave its copy up already
   // check if owner host is same as this machine -
   // if yes serve the page; else get the page from owner and serve it
-  if (owner_idx == c->this_node_idx || page_meta->nodes_reading[c->this_node_idx]) {
-    char *page_start_addr = base_ptr + page_offset*PAGESIZE;
-    memcpy(*data, page_start_addr, PAGESIZE);
+  if (rep_flags != NULL && (flags & FLAG_PAGE_NOUPDATE) && (flags & FLAG_PAGE_WRITE) &&
+      (owner_idx == requestor_idx || (page_meta->copyset & (1ULL << requestor_idx)))) {
+    // the copy of the requestor is still valid; it only needs to write to it
+    *rep_flags |= FLAG_PAGE_NOUPDATE;
+    *count = 0;
+  } else if (owner_idx == c->this_node_idx || (page_meta->copyset & (1ULL << c->this_node_idx))) {
+    // the copy here is read-only once another node has one; see
+    // dsm_getpage_internal_owner
+    if (requestor_idx != c->this_node_idx && page_meta->page_prot == PROT_WRITE &&
+        !(chunk_meta->flags & DSM_CHUNK_MULTIWRITER)) {
+      if ((error=dsm_page_protect(chunk_meta, page_offset, PROT_READ)) < 0)
+        goto cleanup_unlock;
+      page_meta->page_prot = PROT_READ;
+    }
+    char *page_start_addr = base_ptr + page_offset*chunk_meta->block_size;
+    memcpy(*data, page_start_addr, chunk_meta->block_size);
+    if (page_meta->dirty && requestor_idx != c->this_node_idx)
+      owner_flags |= FLAG_PAGE_DIRTY;
+    if (requestor_idx != c->this_node_idx) {
+      page_meta->exclusive = 0;
+      page_meta->dirty = 0;
+    }
   } else {
     // this machine is not the owner of the page
     // get the page from the owner
-    if (owner_idx != requestor_idx) {
-      dsm_request *owner = &g_dsm->clients[owner_idx];
-      char *page_start_addr = base_ptr + page_offset*PAGESIZE;
-      dsm_request_getpage(owner, chunk_id, 
-        page_offset, g_dsm->host, g_dsm->port, data, flags);
-
-      if ((error=mprotect(page_start_addr, PAGESIZE, PROT_WRITE|PROT_READ)) == -1) {
-        print_err("mprotect failed for addr=%p, error=%s\n", page_start_addr, strerror(errno));
+    forward = rep_flags != NULL && owner_idx != requestor_idx &&
+      requestor_idx != c->this_node_idx;
+    if (forward) {
+      if ((flags & FLAG_PAGE_WRITE) && (error=dsm_page_invalidate_copies(chunk_id,
+              page_offset, requestor_idx, owner_idx, flags)) < 0)
         goto cleanup_unlock;
-      }
-      memcpy(page_start_addr, *data, PAGESIZE);
-      page_meta->page_prot = PROT_READ;
-      page_meta->nodes_reading[c->this_node_idx] = 1;
-      if ((error=mprotect(page_start_addr, PAGESIZE, PROT_READ)) == -1) {
-        print_err("mprotect failed for addr=%p, error=%s\n", page_start_addr, strerror(errno));
+      dsm_request *owner = &g_dsm->peers[owner_idx];
+      if ((error=dsm_request_getpage(owner, chunk_id, page_offset, requestor_host, requestor_port,
+              data, chunk_meta->block_size, flags | FLAG_PAGE_FORWARD |
+              (*rep_flags & FLAG_PAGE_EXCLUSIVE), &owner_flags)) < 0)
+        goto cleanup_unlock;
+      *rep_flags |= FLAG_PAGE_FORWARD;
+      *count = 0;
+    } else if (owner_idx != requestor_idx) {
+      taken_idx = owner_idx;
+      dsm_request *owner = &g_dsm->peers[owner_idx];
+      if ((error=dsm_request_getpage(owner, chunk_id, page_offset, g_dsm->host, g_dsm->port,
+              data, chunk_meta->block_size, flags, &owner_flags)) < 0)
         goto cleanup_unlock;
-      }
+      if ((error=dsm_page_install(chunk_meta, page_offset, *data, PROT_READ)) < 0)
+        goto cleanup_unlock;
+      page_meta->page_prot = PROT_READ;
+      page_meta->copyset |= 1ULL << c->this_node_idx;
     }
   }
 
   if (flags & FLAG_PAGE_WRITE) {
     // Invalidate page for all hosts but the new owner
-    for (int i = 0; i < c->num_nodes; i++) {
-      // Continue for requester host and request port
-      if (i == requestor_idx)
-        continue;
-
-      // for master locally invalidate page
-      if (i == c->master_idx) {
-        char *page_start_addr = base_ptr + page_offset*PAGESIZE;
-        if (page_meta->page_prot == PROT_WRITE) {
-          if ((error=mprotect(page_start_addr, PAGESIZE, PROT_NONE)) == -1) {
-            print_err("mprotect failed for addr=%p, error=%s\n", page_start_addr, strerror(errno));
-            goto cleanup_unlock;
-          }
-          page_meta->page_prot = PROT_NONE;
-          page_meta->nodes_reading[c->this_node_idx] = 0;
-        }
-        continue;
-      }
-
-      // send invalidate to only those clients which are using this chunk
-      if (chunk_meta->clients_using[i]) {
-        log("Sending invalidatepage for chunk_id=%"PRIu64", page_offset=%"PRIu64", host:port=%s:%d.\n", 
-            chunk_id, page_offset, c->hosts[i], c->ports[i]);
-        dsm_request_invalidatepage(&g_dsm->clients[i], chunk_id, 
-                                 page_offset, c->hosts[i], c->ports[i], flags);
-      }
-    }
+    if (!forward && (error=dsm_page_invalidate_copies(chunk_id, page_offset,
+            requestor_idx, taken_idx, flags)) < 0)
+      goto cleanup_unlock;
+    page_meta->copyset &= 1ULL << c->this_node_idx;
     // finally update the page map
     page_meta->owner_idx = requestor_idx;
+  } else if (requestor_idx != c->this_node_idx) {
+    // the copyset of the page; a multiple-writer page pushes updates to it
+    page_meta->copyset |= 1ULL << requestor_idx;
   }
 
+  // the writes of the last holder of an exclusive copy come first
+  if (owner_flags & FLAG_PAGE_DIRTY)
+    dsm_adapt_write(g_dsm, chunk_meta, page_offset, owner_idx);
+  if ((flags & FLAG_PAGE_WRITE) && !exclusive)
+    dsm_adapt_write(g_dsm, chunk_meta, page_offset, requestor_idx);
+  else
+    dsm_adapt_read(g_dsm, chunk_meta, page_offset, requestor_idx);
+
 cleanup_unlock:
-  pthread_mutex_unlock(&page_meta->lock);
+  dsm_page_unlock(page_meta);
   log("Released lock, chunk_id: %"PRIu64", %"PRIu64"\n", chunk_id, page_offset);
   return error;
 }
 
 /**
- * This function could be called from dsm_daemon thread and the main thread
- * @return 1 if the host, port is the owner
- *         0 if the host, port is not the owner
- *         -1 incase of error
+ * Serves a GETPAGE for npages pages: the page at page_offset with the
+ * requested flags, followed by prefetched pages at page_offset + i*stride
+ * which are handed out read-only. Prefetching stops at the bounds of the
+ * chunk, at a page another node manages (or owns, in a dynamic chunk), at
+ * a page the requestor owns, at a busy page and at the first page which
+ * can not be served.
+ *
+ * @param data room for npages blocks of the chunk
+ * @param count number of bytes copied to data; 0 if the requestor is
+ *        redirected to another node or the owner sent it the page
+ * @param rep_flags set to the FLAG_PAGE_* of the reply for the first page
+ * @param rep_owner_idx, copyset set for a dynamic chunk; see
+ *        dsm_getpage_internal_dynamic
+ * @return 0 on success; < 0 if the page at page_offset could not be served
  */
-int dsm_allocchunk_internal(dhandle chunk_id, size_t size, 
-    uint8_t *requestor_host, uint32_t requestor_port) {
-  int ret = 0;
+int dsm_getpages_internal(dhandle chunk_id, dhandle page_offset,
+    uint32_t npages, int32_t stride,
+    uint8_t *requestor_host, uint32_t requestor_port,
+    uint8_t **data, uint64_t *count, uint32_t flags, uint32_t *rep_flags,
+    int32_t *rep_owner_idx, uint64_t *copyset) {
   uint32_t i;
-  uint32_t num_pages = 1 + (size-1)/PAGESIZE;
+  int error = 0;
+  uint64_t page_count = 0;
+  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
+  int requestor_idx = get_request_idx(g_dsm, requestor_host, requestor_port);
+
+  *rep_flags = 0;
+  *copyset = 0;
+  if ((error = dsm_getpage_internal(chunk_id, page_offset, requestor_host,
+          requestor_port, data, count, flags, rep_flags, rep_owner_idx, copyset)) < 0)
+    return error;
+  if (*rep_flags & (FLAG_PAGE_REDIRECT | FLAG_PAGE_FORWARD))
+    return 0;
+
+  for (i = 1; i < npages; i++) {
+    int owner_idx = -1;
+    int64_t next = (int64_t)page_offset + (int64_t)i*stride;
+    uint8_t *page_data = *data + (uint64_t)i*chunk_meta->block_size;
+    if (next < 0 || next >= (int64_t)chunk_meta->count ||
+        dsm_page_target(g_dsm, chunk_id, next) != g_dsm->c.this_node_idx)
+      break;
+    if (dsm_locatepage_internal(chunk_id, next, &owner_idx, 0) < 0 ||
+        owner_idx == requestor_idx)
+      break;
+    if (dsm_getpage_internal(chunk_id, next, requestor_host,
+          requestor_port, &page_data, &page_count, FLAG_PAGE_READ, NULL, NULL, NULL) < 0)
+      break;
+  }
+  *count = (uint64_t)i*chunk_meta->block_size;
+  return 0;
+}
+
+/**
+ * Sets a chunk up on this node, the first time any node tells it about
+ * the chunk: maps it and creates the entries of its pages, which hold the
+ * directory state of the pages this node manages.
+ *
+ * @param owner_idx node the pages start out with
+ * @return 0 on success; -1 in case of error
+ */
+static int
+dsm_chunk_setup(dhandle chunk_id, size_t size, uint32_t block_size,
+    uint32_t flags, int owner_idx) {
+  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
+  uint32_t num_pages = size/block_size;
+
+  log("Setting up chunk %"PRIu64", %zu, owner=%d\n", chunk_id, size, owner_idx);
+  chunk_meta->count = num_pages;
+  chunk_meta->block_size = block_size;
+  chunk_meta->flags = flags;
+  if (dsm_chunk_map(g_dsm, chunk_meta, size) < 0)
+    return -1;
+
+  // the owner starts out with all pages. The home of a multiple-writer
+  // chunk write-protects them too, to know which pages to leave write
+  // notices for
+  int prot = PROT_NONE;
+  if (owner_idx == g_dsm->c.this_node_idx)
+    prot = (flags & DSM_CHUNK_MULTIWRITER) ? PROT_READ : PROT_WRITE;
+
+  // the page meta is set up as the pages are used
+  chunk_meta->owner_idx = owner_idx;
+  chunk_meta->prot = prot;
+  chunk_meta->blocks = (dsm_page_block**)calloc(1 + (num_pages-1)/DSM_PAGE_BLOCK,
+      sizeof(dsm_page_block*));
+  if (chunk_meta->blocks == NULL) {
+    print_err("page meta allocation failed\n");
+    return -1;
+  }
+
+  // faults look chunks up by their size; it is only set once the pages are
+  __sync_synchronize();
+  chunk_meta->g_chunk_size = size;
+  return dsm_chunk_register(g_dsm, chunk_meta, prot);
+}
+
+/**
+ * Allocates a chunk. Executes on the master when owner_idx is -1: the
+ * master only records the allocation. The first node to allocate a chunk
+ * owns all of its pages, and the later allocations must agree with the
+ * first one.
+ *
+ * The node then tells every node (itself included) about the chunk, with
+ * the owner the master picked. A node sets the chunk up on the first of
+ * these, as it manages some of its pages, and notes which nodes use it.
+ * A node only faults on the chunk once all nodes know about it.
+ *
+ * @param owner_idx node the pages start out with; -1 on the master
+ * @return node the pages start out with; -1 in case of error
+ */
+int dsm_allocchunk_internal(dhandle chunk_id, size_t size, uint32_t block_size,
+    uint32_t flags, int32_t owner_idx, const uint8_t *requestor_host, uint32_t requestor_port) {
+  if (block_size == 0)
+    block_size = PAGESIZE;
+  uint32_t num_pages = 1 + (size-1)/block_size;
   
-  log("Allocing chunk. Setting page map for chunk %"PRIu64", %zu, owner=%s, port=%d\n", 
+  log("Allocing chunk %"PRIu64", %zu, requestor=%s, port=%d\n", 
       chunk_id, size, requestor_host, requestor_port);
   int requestor_idx = get_request_idx(g_dsm, requestor_host, requestor_port);
   dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
 
-  log("Acquiring lock, chunk_id: %"PRIu64"\n", chunk_id);
-  // fill the owner map with page entries corresponding to the chunk
-  if (chunk_meta->count == 0) {
-    // this is the first node to allocate
-    ret = 1; // make this the owner
+  if (owner_idx >= 0) {
+    if (chunk_meta->g_chunk_size == 0 &&
+        dsm_chunk_setup(chunk_id, (size_t)num_pages*block_size, block_size, flags, owner_idx) < 0)
+      return -1;
+    chunk_meta->clients_using[requestor_idx] = 1;
+    return owner_idx;
+  }
+
+  if (!g_dsm->is_master) {
+    print_err("Allocation of chunk %"PRIu64" sent to a node other than the master\n", chunk_id);
+    return -1;
+  }
 
-    // initialize chunk meta structure
+  if (chunk_meta->ref_counter == 0) {
+    // this is the first node to allocate
     chunk_meta->count = num_pages;
-    chunk_meta->ref_counter = 1;
-    
-    // initialize page meta structure
-    chunk_meta->pages = (dsm_page_meta*)calloc(num_pages, sizeof(dsm_page_meta));
-    for (i = 0; i < num_pages; i++) {
-      if (pthread_mutex_init(&chunk_meta->pages[i].lock, NULL) != 0) {
-        print_err("mutex init failed\n");
-        ret = -1;
-        goto cleanup;
-      }
-      dsm_page_meta *m = &chunk_meta->pages[i];
-      m->owner_idx = requestor_idx;
-    }
-  } else {
-    // this means some other node already created the chunk and is the owner now
-    // just increment the reference count and bail out
-    if (chunk_meta->count != num_pages) {
-      print_err("Inconsistent allocation. Possibly, different nodes allocated different sizes for the same chunk.\n");
-      ret = -1;
-      goto cleanup;
-    }
-    // inc reference counter; new client requested chunk
-    chunk_meta->ref_counter++;
-    chunk_meta->clients_using[get_request_idx(g_dsm, requestor_host, requestor_port)] = 1;
+    chunk_meta->block_size = block_size;
+    chunk_meta->flags = flags;
+
+    // the master is the home of all pages of a multiple-writer chunk,
+    // whichever node allocates it first
+    chunk_meta->owner_idx = requestor_idx;
+    if (flags & DSM_CHUNK_MULTIWRITER)
+      chunk_meta->owner_idx = g_dsm->c.master_idx;
+  } else if (chunk_meta->count != num_pages || chunk_meta->block_size != block_size ||
+      ((uint32_t)chunk_meta->flags ^ flags) &
+      (DSM_CHUNK_MULTIWRITER | DSM_CHUNK_WRITEUPDATE | DSM_CHUNK_DYNAMIC)) {
+    print_err("Inconsistent allocation. Possibly, different nodes allocated different sizes, block sizes or flags for the same chunk.\n");
+    return -1;
   }
-cleanup:
-  log("Released lock, chunk_id: %"PRIu64"\n", chunk_id);
-  return ret;
+
+  // inc reference counter; new client requested chunk
+  chunk_meta->ref_counter++;
+  return chunk_meta->owner_idx;
 }
 
+/**
+ * Frees a chunk. On the master this drops the allocation of the requestor.
+ * The chunk stays set up on all nodes, which keep managing its pages and
+ * serving the copies they have, until the last node frees it. The master
+ * then tells every node to give the chunk up.
+ */
 int dsm_freechunk_internal(dhandle chunk_id,
     const uint8_t *requestor_host, uint32_t requestor_port) {
   log("Freeing chunk %"PRIu64", requestor=%s:%d\n", chunk_id, requestor_host, requestor_port);
-  int requestor_idx = get_request_idx(g_dsm, requestor_host, requestor_port);
   dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
-  if (g_dsm->is_master) {
-    acquire_chunk_lock(chunk_id);
-    if (chunk_meta->count == 0) {
-      print_err("Nothing to free. Chunk not allocated size is 0\n");
-      release_chunk_lock(chunk_id);
-      return -1;
-    }
-    chunk_meta->ref_counter--;
-    chunk_meta->clients_using[requestor_idx] = 0;
-    log("ref counter %d\n", chunk_meta->ref_counter);
-    fetch_remotely_owned_pages(chunk_id, requestor_idx);
-    release_chunk_lock(chunk_id);
-  } 
-  
-  if (g_dsm->is_master == 0 || chunk_meta->ref_counter == 0)
-    dsm_really_freechunk(chunk_id); // MARK1
+  if (!g_dsm->is_master)
+    return dsm_really_freechunk(chunk_id); // MARK1
+
+  if (chunk_meta->ref_counter == 0) {
+    print_err("Nothing to free. Chunk not allocated size is 0\n");
+    return -1;
+  }
+  chunk_meta->ref_counter--;
+  log("ref counter %d\n", chunk_meta->ref_counter);
+  if (chunk_meta->ref_counter > 0)
+    return 0;
+
+  for (int i = 0; i < g_dsm->c.num_nodes; i++) {
+    if (i != g_dsm->c.this_node_idx)
+      dsm_request_freechunk(&g_dsm->peers[i], chunk_id, g_dsm->host, g_dsm->port);
+  }
+  return dsm_really_freechunk(chunk_id);
+}
+
+/**
+ * Merges the diff of a page of a multiple-writer chunk into the copy of
+ * the master, which is the home of the page. Executes on the master.
+ *
+ * The other nodes learn about the write through a write notice, or for
+ * a page which is updated (see dsm_adapt_update) from the writer, which
+ * pushes the diff to the copyset returned here.
+ *
+ * @param node_idx this_node_idx of the writer
+ * @param copyset set to the nodes other than the writer and the master
+ *        with a copy of an updated page; 0 otherwise
+ * @return 0 on success; -1 if the page or the diff is invalid
+ */
+int dsm_pagediff_internal(dhandle chunk_id, dhandle page_offset, uint32_t node_idx,
+    const uint8_t *diff, uint32_t size, uint64_t *copyset) {
+  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
+  *copyset = 0;
+  if (!g_dsm->is_master || page_offset >= chunk_meta->count ||
+      !(chunk_meta->flags & DSM_CHUNK_MULTIWRITER)) {
+    print_err("Diff for a page without a home here, chunk_id=%"PRIu64", page_offset=%"PRIu64"\n",
+        chunk_id, page_offset);
+    return -1;
+  }
+
+  if (dsm_diff_patch(g_dsm, chunk_id, page_offset, diff, size) < 0) {
+    print_err("Malformed diff for chunk_id=%"PRIu64", page_offset=%"PRIu64"\n", chunk_id, page_offset);
+    return -1;
+  }
+
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  dsm_page_lock(page_meta);
+  dsm_adapt_write(g_dsm, chunk_meta, page_offset, node_idx);
+  int update = dsm_adapt_update(g_dsm, chunk_meta, page_offset);
+  if (update)
+    *copyset = dsm_diff_copyset(g_dsm, chunk_meta, page_offset, node_idx);
+  else
+    dsm_diff_forget(g_dsm, chunk_meta, page_offset, node_idx);
+  dsm_page_unlock(page_meta);
+  return update ? 0 : dsm_lrc_log(g_dsm, node_idx, chunk_id, page_offset);
+}
+
+/**
+ * Installs a page whose fault the manager forwarded to its owner, which
+ * sent it here; the threads waiting for it go on right away. The fetch
+ * thread completes the fetch once the reply of the manager is in.
+ *
+ * @param flags FLAG_PAGE_* of the fetch, as the manager forwarded it
+ * @return 0 on success; -1 if no fetch of the page is in flight
+ */
+int dsm_pagedata_internal(dhandle chunk_id, dhandle page_offset, uint32_t flags,
+    const uint8_t *data, uint32_t size) {
+  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
+  if (page_offset >= chunk_meta->count || size != chunk_meta->block_size) {
+    print_err("Data for an unknown page, chunk_id=%"PRIu64", page_offset=%"PRIu64"\n",
+        chunk_id, page_offset);
+    return -1;
+  }
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+
+  // an exclusive copy is installed read-only like any other read
+  int prot = PROT_READ;
+  if ((flags & FLAG_PAGE_WRITE) && !(flags & FLAG_PAGE_EXCLUSIVE))
+    prot = PROT_WRITE;
+
+  int error = -1;
+  dsm_page_lock(page_meta);
+  if ((page_meta->fetch_state & DSM_FETCH_REMOTE) &&
+      dsm_page_install(chunk_meta, page_offset, data, prot) == 0) {
+    page_meta->page_prot = prot;
+    page_meta->copyset |= 1ULL << g_dsm->c.this_node_idx;
+    page_meta->exclusive = (flags & FLAG_PAGE_EXCLUSIVE) != 0;
+    __sync_fetch_and_or(&page_meta->fetch_state, DSM_FETCH_DELIVERED);
+    __sync_fetch_and_and(&page_meta->fetch_state, ~DSM_FETCH_EMPTY);
+    error = 0;
+  }
+  dsm_page_unlock(page_meta);
+  if (error == 0)
+    dsm_fetch_notify(page_meta);
+  return error;
+}
+
+/**
+ * Applies the diff a writer pushed to this node's copy of a page of a
+ * multiple-writer chunk.
+ *
+ * @return 0 on success; -1 if the page or the diff is invalid
+ */
+int dsm_pageupdate_internal(dhandle chunk_id, dhandle page_offset,
+    const uint8_t *diff, uint32_t size) {
+  dsm_chunk_meta *chunk_meta = &g_dsm->g_dsm_page_map[chunk_id];
+  if (page_offset >= chunk_meta->count || !(chunk_meta->flags & DSM_CHUNK_MULTIWRITER)) {
+    print_err("Update for an unknown page, chunk_id=%"PRIu64", page_offset=%"PRIu64"\n",
+        chunk_id, page_offset);
+    return -1;
+  }
+  return dsm_diff_patch(g_dsm, chunk_id, page_offset, diff, size);
+}
+
+/**
+ * Collects the write notices a node has not seen. Executes on the master.
+ *
+ * @param vt notices of each node the requestor has seen
+ * @param vt_out set to the notices of each node logged so far
+ * @param notices set to a malloc'ed array of the new notices
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_acquire_internal(uint32_t node_idx, const uint64_t *vt, uint64_t *vt_out,
+    dsm_write_notice **notices, uint32_t *count) {
+  if (!g_dsm->is_master) {
+    print_err("Acquire sent to a node other than the master\n");
+    return -1;
+  }
+  return dsm_lrc_collect(g_dsm, node_idx, vt, vt_out, notices, count);
+}
+
+/**
+ * Grants a lock or queues the requestor for it. Executes on the master,
+ * which manages all locks; only the daemon thread touches the queues.
+ *
+ * @return 1 if the lock was granted; 0 if the node was queued; -1 in case of error
+ */
+int dsm_lock_internal(dhandle lock_id, uint32_t node_idx) {
+  if (!g_dsm->is_master || lock_id >= NUM_LOCKS || node_idx >= (uint32_t)g_dsm->c.num_nodes) {
+    print_err("Bad lock request, lock_id=%"PRIu64", node=%"PRIu32"\n", lock_id, node_idx);
+    return -1;
+  }
+
+  dsm_lock_meta *m = &g_dsm->locks.meta[lock_id];
+  if (m->holder < 0) {
+    m->holder = node_idx;
+    return 1;
+  }
+  if (m->tail - m->head >= NUM_NODES) {
+    print_err("Lock queue overflow, lock_id=%"PRIu64"\n", lock_id);
+    return -1;
+  }
+  m->queue[m->tail++ % NUM_NODES] = node_idx;
+  return 0;
+}
+
+/**
+ * Releases a lock and picks the next holder from its queue. The node
+ * releasing the lock hands it over itself, so the handoff takes a single
+ * message past this one. Executes on the master.
+ *
+ * @param next_idx set to the next holder; -1 if the lock is free now
+ * @return 0 on success; -1 if the node did not hold the lock
+ */
+int dsm_unlock_internal(dhandle lock_id, uint32_t node_idx, int *next_idx) {
+  if (!g_dsm->is_master || lock_id >= NUM_LOCKS ||
+      g_dsm->locks.meta[lock_id].holder != (int32_t)node_idx) {
+    print_err("Unlock of a lock not held, lock_id=%"PRIu64", node=%"PRIu32"\n", lock_id, node_idx);
+    return -1;
+  }
+
+  dsm_lock_meta *m = &g_dsm->locks.meta[lock_id];
+  if (m->head == m->tail)
+    m->holder = -1;
+  else
+    m->holder = m->queue[m->head++ % NUM_NODES];
+  *next_idx = m->holder;
+  return 0;
+}
+
+/**
+ * Wakes up the thread of this node waiting for a lock handed over to it.
+ */
+int dsm_lockgrant_internal(dhandle lock_id) {
+  if (lock_id >= NUM_LOCKS)
+    return -1;
+
+  dsm_locks *l = &g_dsm->locks;
+  pthread_mutex_lock(&l->lock);
+  l->granted[lock_id] = 1;
+  pthread_cond_broadcast(&l->granted_cond);
+  pthread_mutex_unlock(&l->lock);
   return 0;
 }
 
@@ -392,9 +1094,7 @@ int dsm_barrier_internal() {
   pthread_mutex_lock(&g_dsm->barrier_lock);
   g_dsm->barrier_counter++;
   log("Barrier count:%"PRIu64", num_nodes: %d\n", g_dsm->barrier_counter, g_dsm->c.num_nodes);
-  if (g_dsm->barrier_counter >= (uint64_t)(g_dsm->c.num_nodes)) {
-    pthread_cond_signal(&g_dsm->barrier_cond);
-  }
+  pthread_cond_signal(&g_dsm->barrier_cond);
   pthread_mutex_unlock(&g_dsm->barrier_lock);
   return 0;
 }
@@ -0,0 +1,799 @@
+/**
+ * The fault engine. Faults on shared memory are either caught by the SIGSEGV
+ * handler (see dsm.c) or read from a userfaultfd by the fault thread started
+ * here. Both end up in dsm_fault_handle which fetches the page from its
+ * manager and installs it.
+ *
+ * Page protection is only changed through dsm_page(s)_protect and
+ * dsm_page(s)_install, so the rest of the library does not need to know which
+ * engine is in use. With
+ * userfaultfd the protection states map to
+ *   PROT_NONE  - page not present (zapped with MADV_DONTNEED)
+ *   PROT_READ  - page present and write-protected
+ *   PROT_WRITE - page present and writable
+ *
+ * Several application threads may fault at once. The first fault on a page
+ * claims it (page_meta->fetch_state) and is the only one to move it to its
+ * next state; the other faults on the page wait for that fetch and retry the
+ * access. A write fault behind a read fetch which has not been sent yet
+ * turns it into a write fetch, so it does not take a second round trip.
+ */
+#define _GNU_SOURCE
+
+// included first: include/strings.h shadows the system header and
+// defines 'packed', which breaks __attribute__((packed)) in here
+#ifdef __linux__
+#include <linux/userfaultfd.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "utils.h"
+#include "dsm.h"
+#include "fault.h"
+#include "prefetch.h"
+#include "fetch.h"
+#include "diff.h"
+#include "dsm_internal.h"
+
+// write-protect faults on anonymous memory need linux 5.7 headers
+#if defined(__linux__) && defined(SYS_userfaultfd) && defined(UFFDIO_WRITEPROTECT_MODE_WP)
+#define DSM_HAVE_UFFD 1
+#endif
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+#define DSM_HAVE_MEMFD 1
+#endif
+
+// older headers; the address is a hint then, see dsm_arena_init
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0
+#endif
+
+extern dsm *g_dsm;
+
+/**
+ * Utility function which returns the chunk to which the addr belongs
+ *
+ * @param d dsm object
+ * @param addr faulting address
+ * @return chunk id; NUM_CHUNKS if the address is not in any chunk
+ */
+dhandle dsm_fault_chunk_id(dsm *d, char *addr) {
+  uintptr_t offset = (uintptr_t)addr - (uintptr_t)d->arena;
+  if (addr < d->arena || offset >= DSM_ARENA_SIZE)
+    return NUM_CHUNKS;
+
+  dhandle i = offset >> DSM_CHUNK_SHIFT;
+  if (offset - (i << DSM_CHUNK_SHIFT) >= d->g_dsm_page_map[i].g_chunk_size)
+    return NUM_CHUNKS;
+  return i;
+}
+
+/**
+ * Claims a page for a fetch. Fails if a fetch of the page is already
+ * queued or in flight. The claim is dropped with dsm_fetch_release.
+ *
+ * @param state initial fetch state; DSM_FETCH_CLAIMED, or'ed with
+ *        DSM_FETCH_SENT for pages which can not be upgraded
+ * @return 1 if the page was claimed; 0 otherwise
+ */
+static inline
+int dsm_page_claim(dsm_page_meta *page_meta, uint32_t state) {
+  return __sync_bool_compare_and_swap(&page_meta->fetch_state, 0, state);
+}
+
+/**
+ * Makes a fault wait for the fetch of the page in flight. A write fault
+ * asks for the fetch to be a write fetch; the fetch thread honours this if
+ * it has not sent the request yet.
+ *
+ * @param write_fault 1 if the faulting access was a write
+ * @param wake 1 if the fault waits in the kernel (userfaultfd) and should
+ *        be woken up explicitly
+ * @return 1 if the fault waits for the fetch; 0 if there is none in flight
+ */
+static
+int dsm_page_join(dsm_page_meta *page_meta, int write_fault, int wake) {
+  uint32_t state;
+  while ((state = page_meta->fetch_state) & DSM_FETCH_CLAIMED) {
+    uint32_t next = state;
+    if (write_fault && !(state & DSM_FETCH_SENT))
+      next |= DSM_FETCH_WANT_WRITE;
+    if (wake)
+      next |= DSM_FETCH_WAKE;
+    if (next == state ||
+        __sync_bool_compare_and_swap(&page_meta->fetch_state, state, next))
+      return 1;
+  }
+  return 0;
+}
+
+/**
+ * Services a fault on a shared memory address. Moves the page to its next
+ * protection state and hands the page (and any pages to prefetch along
+ * with it) to the fetch thread.
+ *
+ * This is called from the SIGSEGV handler of any application thread, or
+ * from the userfaultfd thread. It is not async-signal-safe: submitting a
+ * job takes the fetch queue mutex and may wait for room in the queue. A
+ * fault must therefore never be taken while holding that mutex; the fetch
+ * thread and dsm_fetch_submit hold it only to move jobs in and out of the
+ * queue and never touch shared memory under it.
+ *
+ * @param d dsm object
+ * @param addr faulting address
+ * @param write_fault 1 if the faulting access was a write
+ * @param wait 1 to return only once the page is installed
+ * @return 0 on success; -1 if the address is not in a chunk
+ */
+int dsm_fault_handle(dsm *d, char *addr, int write_fault, int wait) {
+  uint32_t flags = 0;
+
+  // get the chunk meta for this addr
+  dhandle chunk_id;
+  if ((chunk_id = dsm_fault_chunk_id(d, addr)) == NUM_CHUNKS) {
+    print_err("Wrong chunk id for addr: 0x%lx chunk_id: %"PRIu64"\n",
+        (long) addr, chunk_id);
+    return -1;
+  }
+
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[chunk_id];
+  char *base_ptr = chunk_meta->g_base_ptr;
+
+  // Build page offset
+  dhandle page_offset = (dhandle)(addr - base_ptr)/chunk_meta->block_size;
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+
+#ifdef _DSM_STATS
+  if (write_fault)
+    __sync_fetch_and_add(&page_meta->num_write_faults, 1);
+  else
+    __sync_fetch_and_add(&page_meta->num_read_faults, 1);
+#endif
+
+  // another thread is already fetching this page; wait for it and let
+  // the access fault again if the page is still not accessible.
+  // fetch_seq is read first so that the wake up can not be missed
+  uint32_t seq = page_meta->fetch_seq;
+  while (!dsm_page_claim(page_meta, DSM_FETCH_CLAIMED)) {
+    if (dsm_page_join(page_meta, write_fault, !wait)) {
+      __sync_fetch_and_add(&chunk_meta->fetches_coalesced, 1);
+      if (wait)
+        dsm_fetch_wait(page_meta, seq);
+      return 0;
+    }
+  }
+
+  // the page was installed between the fault and the claim. Or it is
+  // being invalidated, its protection not yet updated; the access faults
+  // again then, so a thread blocked in userfaultfd is woken up either way
+  if ((!write_fault && page_meta->page_prot != PROT_NONE) ||
+      page_meta->page_prot == PROT_WRITE) {
+    dsm_fetch_release(chunk_meta, page_offset);
+    dsm_page_wake(chunk_meta, page_offset);
+    return 0;
+  }
+
+  // a page of a multiple-writer chunk stays where it is; the first write
+  // keeps a twin to diff the page against at the next release
+  int multiwriter = chunk_meta->flags & DSM_CHUNK_MULTIWRITER;
+  if (multiwriter && write_fault && page_meta->page_prot == PROT_READ) {
+    size_t len = chunk_meta->block_size;
+    dsm_twin_page(chunk_meta, page_offset, (uint8_t*)base_ptr + page_offset*len);
+    if (dsm_page_protect(chunk_meta, page_offset, PROT_WRITE) == 0)
+      page_meta->page_prot = PROT_WRITE;
+    dsm_fetch_release(chunk_meta, page_offset);
+    return 0;
+  }
+
+  // no other node has a copy of the page; the manager learns about the
+  // write when it takes the page back
+  if (write_fault && page_meta->page_prot == PROT_READ && page_meta->exclusive) {
+    int upgraded = 0;
+    dsm_page_lock(page_meta);
+    if (page_meta->exclusive &&
+        dsm_page_protect(chunk_meta, page_offset, PROT_WRITE) == 0) {
+      page_meta->page_prot = PROT_WRITE;
+      page_meta->dirty = 1;
+      __sync_fetch_and_add(&chunk_meta->silent_upgrades, 1);
+      upgraded = 1;
+    }
+    dsm_page_unlock(page_meta);
+    if (upgraded) {
+      dsm_fetch_release(chunk_meta, page_offset);
+      return 0;
+    }
+  }
+
+  // read faults may also prefetch pages the stream is going to touch next;
+  // the window ends at the first page some other fault got to first, and
+  // at the first page which goes to another node than the faulting page
+  uint32_t npages = 1;
+  int32_t stride = 1;
+  if (!write_fault && !(d->flags & DSM_NO_PREFETCH)) {
+    uint32_t want = dsm_prefetch(chunk_meta, page_offset, &stride);
+    int target_idx = dsm_page_target(d, chunk_id, page_offset);
+    for (; npages < want; npages++) {
+      dhandle next = page_offset + (int64_t)npages*stride;
+      dsm_page_meta *m = dsm_chunk_page(chunk_meta, next);
+      if (dsm_page_target(d, chunk_id, next) != target_idx ||
+          !dsm_page_claim(m, DSM_FETCH_CLAIMED | DSM_FETCH_SENT | DSM_FETCH_REMOTE))
+        break;
+      if (m->page_prot != PROT_NONE) {
+        dsm_fetch_release(chunk_meta, page_offset + (int64_t)npages*stride);
+        break;
+      }
+    }
+  }
+
+  // write faults leave the page writable; read faults read-only
+  dsm_fetch_job job = {
+    .chunk_id = chunk_id,
+    .page_offset = page_offset,
+    .npages = npages,
+    .stride = stride,
+    .prot = write_fault ? PROT_WRITE : PROT_READ,
+    .old_prot = page_meta->page_prot,
+    .inval_seq = page_meta->inval_seq,
+  };
+
+  // Use a state transition table for this later?
+  if (page_meta->page_prot == PROT_NONE) {
+    if (write_fault && multiwriter) {
+      // a copy to write to; the master stays the owner
+      flags |= FLAG_PAGE_READ;
+      page_meta->page_prot = PROT_WRITE;
+    } else if (write_fault) {
+      flags |= FLAG_PAGE_WRITE;
+      page_meta->page_prot = PROT_WRITE;
+    } else {
+      flags |= FLAG_PAGE_READ;
+      page_meta->page_prot = PROT_READ;
+    }
+  } else if (page_meta->page_prot == PROT_READ) {
+    // the data is only sent if the copy here is no longer valid
+    flags |= FLAG_PAGE_WRITE | FLAG_PAGE_NOUPDATE;
+    page_meta->page_prot = PROT_WRITE;
+  }
+  job.flags = flags;
+
+  __sync_fetch_and_or(&page_meta->fetch_state, DSM_FETCH_REMOTE |
+      (job.old_prot == PROT_NONE ? DSM_FETCH_EMPTY : 0));
+  seq = page_meta->fetch_seq;
+  if (dsm_fetch_submit(d, &job) < 0) {
+    page_meta->page_prot = job.old_prot;
+    for (uint32_t i = 1; i < npages; i++)
+      dsm_fetch_release(chunk_meta, page_offset + (int64_t)i*stride);
+    dsm_fetch_release(chunk_meta, page_offset);
+    return -1;
+  }
+  if (wait)
+    dsm_fetch_wait(page_meta, seq);
+  return 0;
+}
+
+#ifdef DSM_HAVE_UFFD
+static
+int uffd_protect(int uffd, char *addr, size_t len, int prot, uint64_t mode) {
+  if (prot == PROT_NONE) {
+    // zap the page; the next access raises a missing fault
+    if (madvise(addr, len, MADV_DONTNEED) == -1) {
+      print_err("madvise failed for addr=%p, error=%s\n", addr, strerror(errno));
+      return -1;
+    }
+    return 0;
+  }
+
+  struct uffdio_writeprotect wp = {
+    .range = { .start = (uintptr_t)addr, .len = len },
+    .mode = mode | (prot == PROT_READ ? UFFDIO_WRITEPROTECT_MODE_WP : 0),
+  };
+  if (ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == -1) {
+    print_err("UFFDIO_WRITEPROTECT failed for addr=%p, error=%s\n", addr, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+static
+int uffd_install(int uffd, char *addr, const uint8_t *data, size_t len, int prot) {
+  struct uffdio_copy copy = {
+    .dst = (uintptr_t)addr,
+    .src = (uintptr_t)data,
+    .len = len,
+    .mode = prot == PROT_READ ? UFFDIO_COPY_MODE_WP : 0,
+  };
+  if (ioctl(uffd, UFFDIO_COPY, &copy) == 0)
+    return 0;
+
+  if (errno != EEXIST) {
+    print_err("UFFDIO_COPY failed for addr=%p, error=%s\n", addr, strerror(errno));
+    return -1;
+  }
+
+  // the page is already present (read to write upgrade); update it in place
+  // and only then let the faulting thread continue. Setting write-protection
+  // never wakes anybody, so DONTWAKE is only valid (and needed) when clearing it.
+  if (uffd_protect(uffd, addr, len, PROT_WRITE, UFFDIO_WRITEPROTECT_MODE_DONTWAKE) < 0)
+    return -1;
+  memcpy(addr, data, len);
+  if (prot == PROT_READ && uffd_protect(uffd, addr, len, PROT_READ, 0) < 0)
+    return -1;
+
+  struct uffdio_range range = { .start = (uintptr_t)addr, .len = len };
+  if (ioctl(uffd, UFFDIO_WAKE, &range) == -1) {
+    print_err("UFFDIO_WAKE failed for addr=%p, error=%s\n", addr, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * The fault thread. Reads fault events from the userfaultfd and queues them
+ * for the fetch thread. The faulting thread stays blocked in the kernel until
+ * the page is installed, so this thread does not wait for it.
+ */
+static
+void *dsm_fault_thread_start(void *ptr) {
+  dsm *d = (dsm*)ptr;
+  struct pollfd fds[2] = {
+    { .fd = d->uffd, .events = POLLIN },
+    { .fd = d->fault_pipe[0], .events = POLLIN },
+  };
+
+  log("Starting fault thread\n");
+  while (1) {
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      print_err("poll failed on userfaultfd, error=%s\n", strerror(errno));
+      break;
+    }
+
+    // woken up by dsm_fault_close
+    if (fds[1].revents)
+      break;
+
+    struct uffd_msg msg;
+    if (read(d->uffd, &msg, sizeof(msg)) != sizeof(msg))
+      continue;
+    if (msg.event != UFFD_EVENT_PAGEFAULT)
+      continue;
+
+    char *addr = (char*)(uintptr_t)msg.arg.pagefault.address;
+    int write_fault = (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE) ? 1 : 0;
+    dsm_fault_handle(d, addr, write_fault, 0);
+  }
+
+  return NULL;
+}
+#endif
+
+/**
+ * Reserves size bytes of address space aligned to align, so that blocks
+ * of the chunk can be backed by huge pages.
+ *
+ * @return start of the reservation; MAP_FAILED in case of error
+ */
+static
+void *dsm_chunk_reserve(size_t size, size_t align) {
+  size_t len = size + (align > (size_t)PAGESIZE ? align : 0);
+  char *ptr = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (ptr == MAP_FAILED)
+    return MAP_FAILED;
+
+  // give back the slack on both sides of the aligned range
+  char *start = (char*)(((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1));
+  if (start > ptr)
+    munmap(ptr, start - ptr);
+  if (start + size < ptr + len)
+    munmap(start + size, ptr + len - (start + size));
+  return start;
+}
+
+/**
+ * Reserves the address space of all chunks; see DSM_ARENA_BASE. The
+ * arena goes elsewhere if the address is taken, in which case pointers
+ * into the chunks differ between nodes.
+ *
+ * @return 0 on success; -1 in case of error
+ */
+static
+int dsm_arena_init(dsm *d) {
+  char *arena = mmap((void*)DSM_ARENA_BASE, DSM_ARENA_SIZE, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED_NOREPLACE, -1, 0);
+  if (arena != MAP_FAILED && arena != (char*)DSM_ARENA_BASE) {
+    // kernels before 4.17 take the address as a hint only
+    munmap(arena, DSM_ARENA_SIZE);
+    arena = MAP_FAILED;
+  }
+  if (arena == MAP_FAILED) {
+    log("Arena not available at %p; chunk addresses differ between nodes\n",
+        (void*)DSM_ARENA_BASE);
+    arena = dsm_chunk_reserve(DSM_ARENA_SIZE, (size_t)1 << DSM_CHUNK_SHIFT);
+  }
+  if (arena == MAP_FAILED) {
+    print_err("Could not reserve %zu bytes for the chunks, error=%s\n",
+        DSM_ARENA_SIZE, strerror(errno));
+    return -1;
+  }
+  d->arena = arena;
+  return 0;
+}
+
+/**
+ * Gives the room of a chunk back to the arena, which keeps it reserved.
+ */
+static
+int dsm_chunk_release(void *ptr, size_t size) {
+  if (mmap(ptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED,
+        -1, 0) == MAP_FAILED) {
+    print_err("munmap failed for addr=%p, error=%s\n", ptr, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Sets up the fault engine requested in d->fault_mode. Falls back to
+ * the SIGSEGV handler if userfaultfd can not be used.
+ *
+ * @param d dsm object
+ * @return 0 on success
+ */
+int dsm_fault_init(dsm *d) {
+  if (dsm_arena_init(d) < 0)
+    return -1;
+  if (d->fault_mode != DSM_FAULT_UFFD)
+    return 0;
+
+#ifdef DSM_HAVE_UFFD
+  d->uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+  if (d->uffd == -1) {
+    print_err("userfaultfd failed, error=%s\n", strerror(errno));
+    goto fallback;
+  }
+
+  struct uffdio_api api = {
+    .api = UFFD_API,
+    .features = UFFD_FEATURE_PAGEFAULT_FLAG_WP,
+  };
+  if (ioctl(d->uffd, UFFDIO_API, &api) == -1 ||
+      !(api.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+    print_err("userfaultfd does not support write-protect faults\n");
+    goto fallback_close;
+  }
+
+  if (pipe(d->fault_pipe) == -1) {
+    print_err("pipe failed, error=%s\n", strerror(errno));
+    goto fallback_close;
+  }
+
+  if (pthread_create(&d->fault_thread, NULL, &dsm_fault_thread_start, (void *)d) != 0) {
+    print_err("Fault thread not created! %d\n", -errno);
+    close(d->fault_pipe[0]);
+    close(d->fault_pipe[1]);
+    goto fallback_close;
+  }
+  log("Using userfaultfd fault engine\n");
+  return 0;
+
+fallback_close:
+  close(d->uffd);
+fallback:
+#endif
+  log("userfaultfd not available. Using SIGSEGV handler.\n");
+  d->fault_mode = DSM_FAULT_SIGSEGV;
+  return 0;
+}
+
+int dsm_fault_close(dsm *d) {
+#ifdef DSM_HAVE_UFFD
+  if (d->fault_mode == DSM_FAULT_UFFD) {
+    char c = 0;
+    if (write(d->fault_pipe[1], &c, 1) != 1)
+      print_err("Could not wake up fault thread\n");
+    pthread_join(d->fault_thread, NULL);
+    close(d->fault_pipe[0]);
+    close(d->fault_pipe[1]);
+    close(d->uffd);
+  }
+#endif
+  munmap(d->arena, DSM_ARENA_SIZE);
+  return 0;
+}
+
+/**
+ * Maps memory for a chunk and sets g_base_ptr. The chunk takes the room of
+ * its id in the arena, which is aligned to any block size, and with
+ * DSM_CHUNK_HUGEPAGE is advised to use huge pages.
+ *
+ * With the SIGSEGV handler the chunk is backed by a memfd which is mapped
+ * twice: the application uses g_base_ptr, whose protection follows the page
+ * state, and pages are filled in through g_alias_ptr, which stays writable.
+ * So a page only becomes accessible once its contents are complete, even to
+ * threads which did not fault on it. UFFDIO_COPY installs pages atomically,
+ * so with userfaultfd the chunk is plain anonymous memory.
+ *
+ * Nodes other than the master also get room for the twins of the pages
+ * of a multiple-writer chunk, and so does the master for a write-update
+ * chunk. It is only backed by memory while a page has a twin.
+ *
+ * @param size size of the chunk; a multiple of the block size
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_chunk_map(dsm *d, dsm_chunk_meta *chunk_meta, size_t size) {
+  size_t align = chunk_meta->block_size;
+  dhandle chunk_id = chunk_meta - d->g_dsm_page_map;
+  char *slot = d->arena + (chunk_id << DSM_CHUNK_SHIFT);
+  void *base_ptr = MAP_FAILED;
+  chunk_meta->g_alias_ptr = NULL;
+  chunk_meta->g_twin_ptr = NULL;
+
+  if (size > ((size_t)1 << DSM_CHUNK_SHIFT)) {
+    print_err("Chunk %"PRIu64" of size=%zu does not fit in the arena\n", chunk_id, size);
+    return -1;
+  }
+
+#ifdef DSM_HAVE_MEMFD
+  int fd = -1;
+  if (d->fault_mode == DSM_FAULT_SIGSEGV &&
+      (fd = syscall(SYS_memfd_create, "dsm_chunk", MFD_CLOEXEC)) >= 0) {
+    void *alias_ptr = MAP_FAILED;
+    void *alias_res = dsm_chunk_reserve(size, align);
+    if (ftruncate(fd, size) == 0 && alias_res != MAP_FAILED &&
+        (alias_ptr = mmap(alias_res, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)) != MAP_FAILED &&
+        (base_ptr = mmap(slot, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0)) != MAP_FAILED) {
+      chunk_meta->g_alias_ptr = (char*)alias_ptr;
+    } else {
+      print_err("memfd mapping failed for size=%zu, error=%s\n", size, strerror(errno));
+      if (alias_res != MAP_FAILED)
+        munmap(alias_res, size);
+    }
+    // the mappings keep the memory alive
+    close(fd);
+  }
+#else
+  UNUSED(d);
+#endif
+
+  // fall back to anonymous memory filled in place
+  if (base_ptr == MAP_FAILED)
+    base_ptr = mmap(slot, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  if (base_ptr == MAP_FAILED) {
+    print_err("mmap failed for size=%zu, error=%s\n", size, strerror(errno));
+    return -1;
+  }
+  chunk_meta->g_base_ptr = (char*)base_ptr;
+
+  // the home diffs the pages it pushes to readers; see adapt.c
+  if ((chunk_meta->flags & DSM_CHUNK_MULTIWRITER) && (!d->is_master ||
+        (chunk_meta->flags & DSM_CHUNK_WRITEUPDATE) || !(d->flags & DSM_NO_ADAPT))) {
+    void *twin_ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (twin_ptr == MAP_FAILED) {
+      print_err("mmap failed for twins of size=%zu, error=%s\n", size, strerror(errno));
+      return -1;
+    }
+    chunk_meta->g_twin_ptr = (char*)twin_ptr;
+  }
+
+#ifdef MADV_HUGEPAGE
+  if (chunk_meta->flags & DSM_CHUNK_HUGEPAGE) {
+    if (madvise(base_ptr, size, MADV_HUGEPAGE) == -1 ||
+        (chunk_meta->g_alias_ptr != NULL &&
+         madvise(chunk_meta->g_alias_ptr, size, MADV_HUGEPAGE) == -1))
+      log("No transparent huge pages for addr=%p, error=%s\n", base_ptr, strerror(errno));
+  }
+#endif
+  return 0;
+}
+
+/**
+ * Hands the chunk over to the fault engine and sets the initial
+ * protection of all its pages.
+ *
+ * @param prot PROT_WRITE if this node owns the chunk; PROT_READ for the
+ *        home of a multiple-writer chunk; PROT_NONE otherwise
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_chunk_register(dsm *d, dsm_chunk_meta *chunk_meta, int prot) {
+  char *base_ptr = chunk_meta->g_base_ptr;
+  size_t chunk_size = chunk_meta->g_chunk_size;
+
+#ifdef DSM_HAVE_UFFD
+  if (d->fault_mode == DSM_FAULT_UFFD) {
+    struct uffdio_register reg = {
+      .range = { .start = (uintptr_t)base_ptr, .len = chunk_size },
+      .mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP,
+    };
+    if (ioctl(d->uffd, UFFDIO_REGISTER, &reg) == -1) {
+      print_err("UFFDIO_REGISTER failed for addr=%p, error=%s\n", base_ptr, strerror(errno));
+      return -1;
+    }
+
+    // the owner maps the zero page up front so that it never faults
+    if (prot != PROT_NONE) {
+      struct uffdio_zeropage zero = {
+        .range = { .start = (uintptr_t)base_ptr, .len = chunk_size },
+      };
+      if (ioctl(d->uffd, UFFDIO_ZEROPAGE, &zero) == -1) {
+        print_err("UFFDIO_ZEROPAGE failed for addr=%p, error=%s\n", base_ptr, strerror(errno));
+        return -1;
+      }
+    }
+    if (prot == PROT_READ)
+      return uffd_protect(d->uffd, base_ptr, chunk_size, PROT_READ, 0);
+    return 0;
+  }
+#else
+  UNUSED(d);
+#endif
+
+  if (mprotect(base_ptr, chunk_size, prot == PROT_WRITE ? PROT_READ | PROT_WRITE : prot) == -1) {
+    print_err("mprotect failed for addr=%p, error=%s\n", base_ptr, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+int dsm_chunk_unmap(dsm *d, dsm_chunk_meta *chunk_meta) {
+  char *base_ptr = chunk_meta->g_base_ptr;
+  size_t chunk_size = chunk_meta->g_chunk_size;
+
+#ifdef DSM_HAVE_UFFD
+  if (d->fault_mode == DSM_FAULT_UFFD) {
+    struct uffdio_range range = { .start = (uintptr_t)base_ptr, .len = chunk_size };
+    if (ioctl(d->uffd, UFFDIO_UNREGISTER, &range) == -1)
+      print_err("UFFDIO_UNREGISTER failed for addr=%p, error=%s\n", base_ptr, strerror(errno));
+  }
+#else
+  UNUSED(d);
+#endif
+
+  if (chunk_meta->g_alias_ptr != NULL && munmap(chunk_meta->g_alias_ptr, chunk_size) == -1)
+    print_err("munmap failed for addr=%p, error=%s\n", chunk_meta->g_alias_ptr, strerror(errno));
+  chunk_meta->g_alias_ptr = NULL;
+
+  if (chunk_meta->g_twin_ptr != NULL && munmap(chunk_meta->g_twin_ptr, chunk_size) == -1)
+    print_err("munmap failed for addr=%p, error=%s\n", chunk_meta->g_twin_ptr, strerror(errno));
+  chunk_meta->g_twin_ptr = NULL;
+
+  return dsm_chunk_release(base_ptr, chunk_size);
+}
+
+/**
+ * Counts a protection syscall covering npages pages of the chunk.
+ */
+static
+void dsm_protect_account(dsm_chunk_meta *chunk_meta, uint32_t npages) {
+  __sync_fetch_and_add(&chunk_meta->protect_calls, 1);
+  __sync_fetch_and_add(&chunk_meta->protect_pages, npages);
+}
+
+/**
+ * Changes the protection of npages consecutive pages (blocks) with a
+ * single call. Each call splits the mapping and flushes the TLBs of the
+ * threads of the process, so a change to adjacent pages is best done at
+ * once: the kernel merges the mapping back with its neighbours when their
+ * protection is the same.
+ *
+ * @param prot PROT_NONE, PROT_READ or PROT_WRITE
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_pages_protect(dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t npages, int prot) {
+  size_t len = (size_t)npages*chunk_meta->block_size;
+  char *page_start_addr = chunk_meta->g_base_ptr + page_offset*chunk_meta->block_size;
+
+  dsm_protect_account(chunk_meta, npages);
+#ifdef DSM_HAVE_UFFD
+  if (g_dsm->fault_mode == DSM_FAULT_UFFD)
+    return uffd_protect(g_dsm->uffd, page_start_addr, len, prot, 0);
+#endif
+
+  if (mprotect(page_start_addr, len, prot == PROT_WRITE ? PROT_READ | PROT_WRITE : prot) == -1) {
+    print_err("mprotect failed for addr=%p, error=%s\n", page_start_addr, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Changes the protection of a single page (block).
+ *
+ * @param prot PROT_NONE, PROT_READ or PROT_WRITE
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_page_protect(dsm_chunk_meta *chunk_meta, dhandle page_offset, int prot) {
+  return dsm_pages_protect(chunk_meta, page_offset, 1, prot);
+}
+
+/**
+ * Wakes up the threads blocked on a fault on the page without installing
+ * it; they fault again. Only needed with userfaultfd, where faulting
+ * threads stay blocked in the kernel.
+ *
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_page_wake(dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+#ifdef DSM_HAVE_UFFD
+  if (g_dsm->fault_mode == DSM_FAULT_UFFD) {
+    struct uffdio_range range = {
+      .start = (uintptr_t)(chunk_meta->g_base_ptr + page_offset*chunk_meta->block_size),
+      .len = chunk_meta->block_size,
+    };
+    if (ioctl(g_dsm->uffd, UFFDIO_WAKE, &range) == -1) {
+      print_err("UFFDIO_WAKE failed for addr=%p, error=%s\n", (void*)range.start, strerror(errno));
+      return -1;
+    }
+  }
+#else
+  UNUSED(chunk_meta);
+  UNUSED(page_offset);
+#endif
+  return 0;
+}
+
+/**
+ * Copies the data of npages consecutive pages in and leaves them with
+ * the given protection, with as few protection changes as the engine
+ * allows. The pages must all be missing, or all be present.
+ *
+ * @param data contents of the pages, one after the other
+ * @param prot PROT_READ or PROT_WRITE
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_pages_install(dsm_chunk_meta *chunk_meta, dhandle page_offset, uint32_t npages,
+    const uint8_t *data, int prot) {
+  size_t len = (size_t)npages*chunk_meta->block_size;
+  char *page_start_addr = chunk_meta->g_base_ptr + page_offset*chunk_meta->block_size;
+
+#ifdef DSM_HAVE_UFFD
+  if (g_dsm->fault_mode == DSM_FAULT_UFFD) {
+    dsm_protect_account(chunk_meta, npages);
+    return uffd_install(g_dsm->uffd, page_start_addr, data, len, prot);
+  }
+#endif
+
+  // fill the pages in through the alias before they become accessible
+  if (chunk_meta->g_alias_ptr != NULL) {
+    memcpy(chunk_meta->g_alias_ptr + page_offset*chunk_meta->block_size, data, len);
+    return dsm_pages_protect(chunk_meta, page_offset, npages, prot);
+  }
+
+  // temporarily set the protection to READ/WRITE to update the pages
+  if (dsm_pages_protect(chunk_meta, page_offset, npages, PROT_WRITE) < 0)
+    return -1;
+  memcpy(page_start_addr, data, len);
+
+  // reset protection back to read if it is just read fault
+  if (prot != PROT_WRITE)
+    return dsm_pages_protect(chunk_meta, page_offset, npages, prot);
+  return 0;
+}
+
+/**
+ * Copies a block of data into the page and leaves it with
+ * the given protection.
+ *
+ * @param data page contents
+ * @param prot PROT_READ or PROT_WRITE
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_page_install(dsm_chunk_meta *chunk_meta, dhandle page_offset,
+    const uint8_t *data, int prot) {
+  return dsm_pages_install(chunk_meta, page_offset, 1, data, prot);
+}
@@ -0,0 +1,546 @@
+/**
+ * The fetch service. Faults are not serviced by the faulting thread itself:
+ * dsm_fault_handle queues a dsm_fetch_job and the fetch thread started here
+ * requests the pages from their manager and installs them.
+ *
+ * The fetch thread keeps up to DSM_FETCH_SLOTS requests to each node in
+ * flight on one connection, and polls the connections for replies, which
+ * are matched to the requests by id. So
+ * faults of different threads (or a fault and the prefetches of another)
+ * overlap instead of waiting for each other's round trips. Jobs are sent
+ * in order; a job whose manager has no idle slot holds the ones behind it.
+ * A fault on a page of a dynamic chunk goes to the probable owner of the
+ * page instead, and is sent on if that node redirects it.
+ *
+ * Faults on a page whose fetch is queued or in flight do not queue another
+ * one; they wait for it. A queued read fetch becomes a write fetch if a write
+ * fault is waiting for it by the time it is sent.
+ *
+ * A thread which faulted through the SIGSEGV handler parks on the fetch_seq
+ * futex of the page until the fetch thread bumps it. With userfaultfd the
+ * kernel keeps the faulting thread blocked until the page is installed.
+ */
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#endif
+
+#include "utils.h"
+#include "dsm.h"
+#include "reply_handler.h"
+#include "fault.h"
+#include "fetch.h"
+#include "prefetch.h"
+#include "diff.h"
+#include "dsm_internal.h"
+
+/**
+ * Wakes up the threads parked on the fetch of a page. Also called once the
+ * page is in, ahead of the reply; see dsm_pagedata_internal.
+ */
+void dsm_fetch_notify(dsm_page_meta *page_meta) {
+  __sync_fetch_and_add(&page_meta->fetch_seq, 1);
+#ifdef __linux__
+  syscall(SYS_futex, &page_meta->fetch_seq, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+#endif
+}
+
+/**
+ * Drops the claim on a page and wakes up the threads waiting for its fetch.
+ */
+void dsm_fetch_release(dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, page_offset);
+  uint32_t state = __sync_lock_test_and_set(&page_meta->fetch_state, 0);
+  dsm_fetch_notify(page_meta);
+
+  // faults which joined the fetch may have missed the wake up of the install
+  if (state & DSM_FETCH_WAKE)
+    dsm_page_wake(chunk_meta, page_offset);
+}
+
+/**
+ * Locks the pages prefetched along with the faulting page of a job, in
+ * order, up to and including the first one invalidated meanwhile.
+ *
+ * @param fetched pages in the reply, the faulting one included
+ * @param locked set to the pages locked, plus one for the faulting page
+ * @return the number of pages which can be installed
+ */
+static
+uint32_t dsm_fetch_lock_prefetched(dsm_chunk_meta *chunk_meta, dsm_fetch_job *job,
+    uint32_t fetched, uint32_t *locked) {
+  uint32_t prefetched = 0;
+  *locked = 1;
+  while (*locked < fetched) {
+    dsm_page_meta *m = dsm_chunk_page(chunk_meta, job->page_offset + (int64_t)*locked*job->stride);
+    dsm_page_lock(m);
+    (*locked)++;
+    if (m->fetch_state & DSM_FETCH_STALE)
+      break;
+    prefetched++;
+  }
+  return prefetched;
+}
+
+/**
+ * Installs the pages of a completed fetch and wakes up the threads
+ * waiting for them.
+ *
+ * A page which was invalidated while its request was in flight is not
+ * installed: the reply may predate the invalidation. The access then
+ * faults again. A reply which hands the page over to this node is newer
+ * though: the manager takes a page back from its owner with a GETPAGE,
+ * which waits for the install, and not with an invalidation. Unless it
+ * comes without the data (FLAG_PAGE_NOUPDATE): the read-only copy here it
+ * makes writable is gone. Nor is it writable once this node served a read
+ * from it meanwhile, which left the copy read-only again; the reader would
+ * not see the writes.
+ *
+ * This node owns a page of a dynamic chunk once a write fetch of it is
+ * in. It invalidates the copyset it got with the page first.
+ *
+ * A page the manager had its owner send here directly is installed by
+ * then; the reply only completes the fetch.
+ *
+ * @param rep reply to the GETPAGE; NULL if the fetch failed
+ */
+static
+void dsm_fetch_complete(dsm *d, dsm_fetch_job *job, dsm_rep *rep) {
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[job->chunk_id];
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, job->page_offset);
+  uint8_t *data = NULL;
+  uint32_t fetched = 0;
+  uint32_t prefetched = 0;
+  uint32_t locked = 1;
+  int installed = 0;
+  int batched = 0;
+  int dynamic = chunk_meta->flags & DSM_CHUNK_DYNAMIC;
+
+  // a copy which was not invalidated may still be read; the page is not
+  // taken over then
+  if (rep != NULL && dynamic &&
+      dsm_request_invalidatepages(d->peers, d->c.num_nodes,
+        rep->content.getpage_rep.copyset, job->chunk_id, job->page_offset,
+        d->host, d->port, FLAG_PAGE_WRITE) < 0) {
+    rep = NULL;
+  }
+
+  dsm_page_lock(page_meta);
+  if (rep == NULL) {
+    // for now the page is left as it was and the access faults again
+    print_err("getpage failed for chunk_id=%"PRIu64", page_offset=%"PRIu64"\n",
+        job->chunk_id, job->page_offset);
+    if (page_meta->inval_seq == job->inval_seq)
+      page_meta->page_prot = job->old_prot;
+  } else if (rep->content.getpage_rep.flags & FLAG_PAGE_FORWARD) {
+    installed = (page_meta->fetch_state & DSM_FETCH_DELIVERED) != 0;
+    if (!installed && page_meta->inval_seq == job->inval_seq)
+      page_meta->page_prot = job->old_prot;
+  } else if ((page_meta->inval_seq != job->inval_seq &&
+        ((rep->content.getpage_rep.flags & FLAG_PAGE_NOUPDATE) ||
+         !((job->flags & FLAG_PAGE_WRITE) ||
+          (rep->content.getpage_rep.flags & FLAG_PAGE_EXCLUSIVE)))) ||
+      ((rep->content.getpage_rep.flags & FLAG_PAGE_NOUPDATE) &&
+       page_meta->page_prot != job->prot)) {
+    log("Dropping getpage for invalidated page chunk_id=%"PRIu64", page_offset=%"PRIu64"\n",
+        job->chunk_id, job->page_offset);
+  } else {
+    data = rep->content.getpage_rep.data;
+    fetched = rep->content.getpage_rep.count / chunk_meta->block_size;
+    if (fetched > job->npages)
+      fetched = job->npages;
+
+    // a write fault on a multiple-writer page writes to a copy; keep a twin
+    if ((chunk_meta->flags & DSM_CHUNK_MULTIWRITER) && job->prot == PROT_WRITE)
+      dsm_twin_page(chunk_meta, job->page_offset, data);
+
+    // a read of contiguous pages goes in with the pages prefetched after
+    // it, with a single protection change. These are locked after the
+    // faulting page, in order
+    batched = job->prot == PROT_READ && job->stride == 1 &&
+      !(rep->content.getpage_rep.flags & FLAG_PAGE_NOUPDATE);
+    if (batched)
+      prefetched = dsm_fetch_lock_prefetched(chunk_meta, job, fetched, &locked);
+
+    if (rep->content.getpage_rep.flags & FLAG_PAGE_NOUPDATE)
+      installed = dsm_page_protect(chunk_meta, job->page_offset, job->prot) == 0;
+    else
+      installed = dsm_pages_install(chunk_meta, job->page_offset, 1 + prefetched,
+          data, job->prot) == 0;
+    if (!installed)
+      prefetched = 0;
+    if (installed)
+      page_meta->page_prot = job->prot;
+    if (dynamic && (job->flags & FLAG_PAGE_WRITE)) {
+      page_meta->copyset = 0;
+      page_meta->owner_idx = d->c.this_node_idx;
+    } else if (dynamic) {
+      page_meta->owner_idx = rep->content.getpage_rep.owner_idx;
+    }
+    page_meta->copyset |= 1ULL << d->c.this_node_idx;
+    page_meta->exclusive = installed && (rep->content.getpage_rep.flags & FLAG_PAGE_EXCLUSIVE);
+  }
+  __sync_fetch_and_and(&page_meta->fetch_state, ~(DSM_FETCH_REMOTE | DSM_FETCH_EMPTY));
+  dsm_page_unlock(page_meta);
+
+  // otherwise install the prefetched pages read-only before they are
+  // touched; a contiguous batch with a single protection change. A page
+  // invalidated meanwhile is dropped, and so are the pages after it
+  if (installed && !batched) {
+    prefetched = dsm_fetch_lock_prefetched(chunk_meta, job, fetched, &locked);
+    if (prefetched > 0 && job->stride == 1) {
+      if (dsm_pages_install(chunk_meta, job->page_offset + 1, prefetched,
+            data + chunk_meta->block_size, PROT_READ) < 0)
+        prefetched = 0;
+    } else {
+      for (uint32_t i = 1; i <= prefetched; i++) {
+        if (dsm_page_install(chunk_meta, job->page_offset + (int64_t)i*job->stride,
+              data + (uint64_t)i*chunk_meta->block_size, PROT_READ) < 0) {
+          prefetched = i - 1;
+          break;
+        }
+      }
+    }
+  }
+  for (uint32_t i = 1; i < job->npages; i++) {
+    dhandle next = job->page_offset + (int64_t)i*job->stride;
+    dsm_page_meta *m = dsm_chunk_page(chunk_meta, next);
+    if (i <= prefetched) {
+      m->page_prot = PROT_READ;
+      m->copyset |= 1ULL << d->c.this_node_idx;
+      if (dynamic)
+        m->owner_idx = rep->content.getpage_rep.owner_idx;
+    }
+    if (i < locked) {
+      __sync_fetch_and_and(&m->fetch_state, ~DSM_FETCH_REMOTE);
+      dsm_page_unlock(m);
+    }
+    dsm_fetch_release(chunk_meta, next);
+  }
+  if (installed)
+    dsm_prefetch_account(chunk_meta, 1 + prefetched, job->stride);
+  else
+    dsm_page_wake(chunk_meta, job->page_offset);
+
+  dsm_fetch_release(chunk_meta, job->page_offset);
+}
+
+/**
+ * Returns an idle slot connected to a node; -1 if all of them are busy.
+ */
+static
+int dsm_fetch_slot(dsm_fetch *f, int node_idx) {
+  for (int i = node_idx*DSM_FETCH_SLOTS; i < (node_idx + 1)*DSM_FETCH_SLOTS; i++) {
+    if (!f->busy[i])
+      return i;
+  }
+  return -1;
+}
+
+/**
+ * Returns the number of jobs in slots or waiting to be sent again.
+ */
+static
+int dsm_fetch_outstanding(dsm_fetch *f, int nslots) {
+  int n = f->nretry;
+  for (int i = 0; i < nslots; i++)
+    n += f->busy[i];
+  return n;
+}
+
+/**
+ * Points a job at the node another node redirected it to, as the probable
+ * owner of the page, and has it sent again. A job redirected more often
+ * than there are nodes follows stale hints in a circle; it fails, and the
+ * access faults again.
+ */
+static
+void dsm_fetch_redirect(dsm *d, dsm_fetch_job *job, int owner_idx) {
+  dsm_fetch *f = &d->fetch;
+  dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[job->chunk_id];
+  dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, job->page_offset);
+
+  if (++job->hops > (uint32_t)d->c.num_nodes) {
+    print_err("getpage redirected %"PRIu32" times for chunk_id=%"PRIu64", page_offset=%"PRIu64"\n",
+        job->hops, job->chunk_id, job->page_offset);
+    dsm_fetch_complete(d, job, NULL);
+    return;
+  }
+
+  log("Redirected getpage chunk_id=%"PRIu64", page_offset=%"PRIu64" to node %d\n",
+      job->chunk_id, job->page_offset, owner_idx);
+  dsm_page_lock(page_meta);
+  if (owner_idx >= 0 && owner_idx < d->c.num_nodes && owner_idx != d->c.this_node_idx)
+    page_meta->owner_idx = owner_idx;
+  dsm_page_unlock(page_meta);
+  __sync_fetch_and_add(&chunk_meta->redirects, 1);
+  assert(f->nretry < d->c.num_nodes*DSM_FETCH_SLOTS);
+  f->retry[f->nretry++] = *job;
+}
+
+/**
+ * Sends the request of the job in slot i.
+ */
+static
+void dsm_fetch_send(dsm *d, int i) {
+  dsm_fetch *f = &d->fetch;
+  dsm_fetch_job *job = &f->jobs[i];
+  if (dsm_request_getpages_send(&f->conns[i / DSM_FETCH_SLOTS], &f->calls[i],
+        job->chunk_id, job->page_offset,
+        job->npages, job->stride, d->host, d->port, job->flags) < 0) {
+    dsm_fetch_complete(d, job, NULL);
+    return;
+  }
+  f->busy[i] = 1;
+}
+
+/**
+ * Hands queued jobs to idle slots connected to the nodes their pages go
+ * to (see dsm_page_target) and sends their requests. Redirected jobs go
+ * out first.
+ */
+static
+void dsm_fetch_dispatch(dsm *d) {
+  dsm_fetch *f = &d->fetch;
+  int nslots = d->c.num_nodes*DSM_FETCH_SLOTS;
+
+  for (int j = 0; j < f->nretry;) {
+    dsm_fetch_job *job = &f->retry[j];
+    int i = dsm_fetch_slot(f, dsm_page_target(d, job->chunk_id, job->page_offset));
+    if (i < 0) {
+      j++;
+      continue;
+    }
+    f->jobs[i] = *job;
+    f->retry[j] = f->retry[--f->nretry];
+    dsm_fetch_send(d, i);
+  }
+
+  // a job in a slot may be redirected; keep room for it in retry
+  for (;;) {
+    if (dsm_fetch_outstanding(f, nslots) >= nslots)
+      return;
+    pthread_mutex_lock(&f->lock);
+    if (f->head == f->tail) {
+      pthread_mutex_unlock(&f->lock);
+      return;
+    }
+    dsm_fetch_job *next = &f->queue[f->head % DSM_FETCH_QUEUE];
+    int i = dsm_fetch_slot(f, dsm_page_target(d, next->chunk_id, next->page_offset));
+    if (i < 0) {
+      pthread_mutex_unlock(&f->lock);
+      return;
+    }
+    f->jobs[i] = *next;
+    f->head++;
+    pthread_cond_signal(&f->not_full);
+    pthread_mutex_unlock(&f->lock);
+
+    // a write fault waiting behind this read fetch gets the page
+    // writable in the same round trip
+    dsm_fetch_job *job = &f->jobs[i];
+    dsm_chunk_meta *chunk_meta = &d->g_dsm_page_map[job->chunk_id];
+    dsm_page_meta *page_meta = dsm_chunk_page(chunk_meta, job->page_offset);
+    uint32_t state = __sync_fetch_and_or(&page_meta->fetch_state, DSM_FETCH_SENT);
+    if ((state & DSM_FETCH_WANT_WRITE) && job->prot != PROT_WRITE) {
+      if (!(chunk_meta->flags & DSM_CHUNK_MULTIWRITER))
+        job->flags = (job->flags & ~FLAG_PAGE_READ) | FLAG_PAGE_WRITE;
+      job->prot = PROT_WRITE;
+      page_meta->page_prot = PROT_WRITE;
+      __sync_fetch_and_add(&chunk_meta->fetches_upgraded, 1);
+    }
+    dsm_fetch_send(d, i);
+  }
+}
+
+static
+void *dsm_fetch_thread_start(void *ptr) {
+  dsm *d = (dsm*)ptr;
+  dsm_fetch *f = &d->fetch;
+  int nslots = d->c.num_nodes*DSM_FETCH_SLOTS;
+  struct pollfd fds[1 + d->c.num_nodes];
+  int node_idx[1 + d->c.num_nodes];
+
+  log("Starting fetch thread\n");
+  while (!f->terminated) {
+    dsm_fetch_dispatch(d);
+
+    // wait for new jobs and for the replies of the requests in flight
+    int nfds = 0;
+    fds[nfds++] = (struct pollfd){ .fd = f->pipe[0], .events = POLLIN };
+    for (int i = 0; i < nslots; i++) {
+      int n = i / DSM_FETCH_SLOTS;
+      if (!f->busy[i] || (nfds > 1 && node_idx[nfds - 1] == n))
+        continue;
+      node_idx[nfds] = n;
+      fds[nfds++] = (struct pollfd){ .fd = f->rcvfd[n], .events = POLLIN };
+    }
+
+    if (poll(fds, nfds, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      print_err("poll failed in fetch thread, error=%s\n", strerror(errno));
+      break;
+    }
+
+    if (fds[0].revents) {
+      char buf[64];
+      while (read(f->pipe[0], buf, sizeof(buf)) > 0);
+    }
+
+    for (int j = 1; j < nfds; j++) {
+      if (!fds[j].revents)
+        continue;
+      int n = node_idx[j];
+      dsm_call *call;
+      if (dsm_request_next(&f->conns[n], &call) < 0) {
+        // the connection failed; the replies in flight on it are lost
+        for (int i = n*DSM_FETCH_SLOTS; i < (n + 1)*DSM_FETCH_SLOTS; i++) {
+          if (!f->busy[i])
+            continue;
+          dsm_request_cancel(&f->conns[n], &f->calls[i]);
+          f->busy[i] = 0;
+          dsm_fetch_complete(d, &f->jobs[i], NULL);
+        }
+        continue;
+      }
+      if (call == NULL)
+        continue;
+      int i = call - f->calls;
+      dsm_rep *rep = dsm_request_getpages_recv(&f->conns[n], call);
+      f->busy[i] = 0;
+      if (rep && (rep->content.getpage_rep.flags & FLAG_PAGE_REDIRECT))
+        dsm_fetch_redirect(d, &f->jobs[i], rep->content.getpage_rep.owner_idx);
+      else
+        dsm_fetch_complete(d, &f->jobs[i], rep);
+      if (rep)
+        comm_free(&f->conns[n].c, rep);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Queues a fault for the fetch thread. Waits if the queue is full.
+ *
+ * @return 0 on success; -1 if the fetch service is not running
+ */
+int dsm_fetch_submit(dsm *d, const dsm_fetch_job *job) {
+  dsm_fetch *f = &d->fetch;
+  if (f->terminated)
+    return -1;
+
+  pthread_mutex_lock(&f->lock);
+  while (f->tail - f->head >= DSM_FETCH_QUEUE)
+    pthread_cond_wait(&f->not_full, &f->lock);
+  f->queue[f->tail % DSM_FETCH_QUEUE] = *job;
+  f->tail++;
+  pthread_mutex_unlock(&f->lock);
+
+  // the pipe is non-blocking; if it is full the thread is awake anyway
+  char c = 0;
+  if (write(f->pipe[1], &c, 1) < 0 && errno != EAGAIN)
+    print_err("Could not wake up fetch thread\n");
+  return 0;
+}
+
+/**
+ * Parks the calling thread until a fetch of the page completes.
+ * Safe to call from a signal handler.
+ *
+ * @param seq value of page_meta->fetch_seq read before the job was submitted
+ */
+void dsm_fetch_wait(dsm_page_meta *page_meta, uint32_t seq) {
+  while (page_meta->fetch_seq == seq) {
+#ifdef __linux__
+    syscall(SYS_futex, &page_meta->fetch_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+    sched_yield();
+#endif
+  }
+}
+
+/**
+ * Opens the connections to all nodes and starts the fetch thread.
+ *
+ * @param d dsm object
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_fetch_init(dsm *d) {
+  dsm_fetch *f = &d->fetch;
+  dsm_conf *c = &d->c;
+
+  f->terminated = 0;
+  f->head = f->tail = 0;
+  if (pthread_mutex_init(&f->lock, NULL) != 0 ||
+      pthread_cond_init(&f->not_full, NULL) != 0) {
+    print_err("fetch lock init failed\n");
+    return -1;
+  }
+
+  if (pipe2(f->pipe, O_NONBLOCK | O_CLOEXEC) == -1) {
+    print_err("pipe failed, error=%s\n", strerror(errno));
+    return -1;
+  }
+
+  int nslots = c->num_nodes*DSM_FETCH_SLOTS;
+  f->conns = (dsm_request*)calloc(c->num_nodes, sizeof(dsm_request));
+  f->rcvfd = (int*)calloc(c->num_nodes, sizeof(int));
+  f->calls = (dsm_call*)calloc(nslots, sizeof(dsm_call));
+  f->jobs = (dsm_fetch_job*)calloc(nslots, sizeof(dsm_fetch_job));
+  f->busy = (int*)calloc(nslots, sizeof(int));
+  f->retry = (dsm_fetch_job*)calloc(nslots, sizeof(dsm_fetch_job));
+  f->nretry = 0;
+  for (int i = 0; i < c->num_nodes; i++) {
+    if (dsm_request_init(&f->conns[i], c->hosts[i], c->ports[i]) < 0) {
+      print_err("Could not connect fetch thread to node %d\n", i);
+      return -1;
+    }
+    if ((f->rcvfd[i] = comm_receive_fd(&f->conns[i].c)) < 0)
+      return -1;
+  }
+
+  if (pthread_create(&f->thread, NULL, &dsm_fetch_thread_start, (void *)d) != 0) {
+    print_err("Fetch thread not created! %d\n", -errno);
+    return -1;
+  }
+  return 0;
+}
+
+int dsm_fetch_close(dsm *d) {
+  dsm_fetch *f = &d->fetch;
+
+  f->terminated = 1;
+  char c = 0;
+  if (write(f->pipe[1], &c, 1) < 0 && errno != EAGAIN)
+    print_err("Could not wake up fetch thread\n");
+  pthread_join(f->thread, NULL);
+
+  for (int i = 0; i < d->c.num_nodes; i++)
+    dsm_request_close(&f->conns[i]);
+  free(f->conns);
+  free(f->rcvfd);
+  free(f->calls);
+  free(f->jobs);
+  free(f->busy);
+  free(f->retry);
+  close(f->pipe[0]);
+  close(f->pipe[1]);
+  pthread_cond_destroy(&f->not_full);
+  pthread_mutex_destroy(&f->lock);
+  return 0;
+}
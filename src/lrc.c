@@ -0,0 +1,176 @@
+/**
+ * Lazy release consistency for multiple-writer chunks. A node's writes only
+ * have to be visible to the nodes which synchronize with it afterwards, so
+ * a write costs no messages when it happens:
+ *   release - the node sends the diffs of the pages it wrote to the master
+ *             (see diff.c). The master logs a write notice per page.
+ *   acquire - the node asks the master for the notices it has not seen and
+ *             drops its copies of those pages. They are fetched again from
+ *             the master on the next access.
+ * Pages nobody else wrote stay valid across synchronization.
+ *
+ * The notices of each node are numbered in the order the master logs them.
+ * A node's vector timestamp vt[w] is the number of notices of node w it has
+ * seen; it sends the vector with an acquire and gets back the notices past
+ * it. Notices all nodes have seen are trimmed from the log.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "dsm.h"
+#include "diff.h"
+#include "lrc.h"
+
+int dsm_lrc_init(dsm *d) {
+  memset(&d->lrc, 0, sizeof(d->lrc));
+  if (pthread_mutex_init(&d->lrc.lock, NULL) != 0) {
+    print_err("write notice lock init failed\n");
+    return -1;
+  }
+  if (pthread_mutex_init(&d->lrc.diff_lock, NULL) != 0) {
+    print_err("diff lock init failed\n");
+    pthread_mutex_destroy(&d->lrc.lock);
+    return -1;
+  }
+  return 0;
+}
+
+void dsm_lrc_close(dsm *d) {
+  for (int i = 0; i < NUM_NODES; i++)
+    free(d->lrc.log[i]);
+  pthread_mutex_destroy(&d->lrc.lock);
+  pthread_mutex_destroy(&d->lrc.diff_lock);
+}
+
+/**
+ * Logs that a node released a write to a page. Executes on the master.
+ *
+ * @param writer this_node_idx of the writer
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_lrc_log(dsm *d, uint32_t writer, dhandle chunk_id, dhandle page_offset) {
+  dsm_lrc *l = &d->lrc;
+  if (writer >= NUM_NODES)
+    return -1;
+
+  pthread_mutex_lock(&l->lock);
+  uint64_t n = l->count[writer] - l->base[writer];
+  if (n == l->cap[writer]) {
+    uint64_t cap = l->cap[writer] ? 2*l->cap[writer] : 64;
+    dsm_write_notice *log = realloc(l->log[writer], cap*sizeof(dsm_write_notice));
+    if (log == NULL) {
+      pthread_mutex_unlock(&l->lock);
+      print_err("Could not grow the write notice log of node %"PRIu32"\n", writer);
+      return -1;
+    }
+    l->log[writer] = log;
+    l->cap[writer] = cap;
+  }
+  l->log[writer][n] = (dsm_write_notice){ .chunk_id = chunk_id, .page_offset = page_offset };
+  l->count[writer]++;
+  pthread_mutex_unlock(&l->lock);
+  return 0;
+}
+
+/**
+ * Drops the notices of a node which every other node has seen.
+ * The home (master) and the writer itself never need them.
+ * Call with the lock held.
+ */
+static
+void dsm_lrc_trim(dsm *d, uint32_t writer) {
+  dsm_lrc *l = &d->lrc;
+  uint64_t min = l->count[writer];
+  for (int i = 0; i < d->c.num_nodes; i++) {
+    if (i == d->c.master_idx || (uint32_t)i == writer)
+      continue;
+    if (l->seen[i][writer] < min)
+      min = l->seen[i][writer];
+  }
+  if (min <= l->base[writer])
+    return;
+
+  uint64_t drop = min - l->base[writer];
+  memmove(l->log[writer], l->log[writer] + drop,
+      (l->count[writer] - min)*sizeof(dsm_write_notice));
+  l->base[writer] = min;
+}
+
+/**
+ * Collects the notices a node has not seen yet. Executes on the master.
+ *
+ * @param node_idx this_node_idx of the acquiring node
+ * @param vt notices of each node it has seen
+ * @param vt_out set to the notices of each node logged so far
+ * @param notices set to a malloc'ed array of the notices past vt
+ * @param count set to the number of notices
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_lrc_collect(dsm *d, uint32_t node_idx, const uint64_t *vt,
+    uint64_t *vt_out, dsm_write_notice **notices, uint32_t *count) {
+  dsm_lrc *l = &d->lrc;
+  if (node_idx >= NUM_NODES)
+    return -1;
+
+  pthread_mutex_lock(&l->lock);
+  uint64_t total = 0;
+  for (int w = 0; w < d->c.num_nodes; w++) {
+    uint64_t from = vt[w] > l->base[w] ? vt[w] : l->base[w];
+    if ((uint32_t)w != node_idx && from < l->count[w])
+      total += l->count[w] - from;
+  }
+
+  *notices = (dsm_write_notice*)malloc(total ? total*sizeof(dsm_write_notice) : 1);
+  if (*notices == NULL) {
+    pthread_mutex_unlock(&l->lock);
+    return -1;
+  }
+
+  uint32_t n = 0;
+  memset(vt_out, 0, NUM_NODES*sizeof(uint64_t));
+  for (int w = 0; w < d->c.num_nodes; w++) {
+    uint64_t from = vt[w] > l->base[w] ? vt[w] : l->base[w];
+    if ((uint32_t)w != node_idx && from < l->count[w]) {
+      uint64_t k = l->count[w] - from;
+      memcpy(*notices + n, l->log[w] + (from - l->base[w]), k*sizeof(dsm_write_notice));
+      n += k;
+    }
+    vt_out[w] = l->count[w];
+    l->seen[node_idx][w] = l->count[w];
+    dsm_lrc_trim(d, w);
+  }
+  *count = n;
+  pthread_mutex_unlock(&l->lock);
+  return 0;
+}
+
+/**
+ * Fetches the write notices this node has not seen from the master and
+ * drops the copies of the pages they name.
+ *
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_lrc_acquire(dsm *d) {
+  dsm_write_notice *notices = NULL;
+  uint32_t count = 0;
+  int error = 0;
+
+  if (dsm_request_acquire(d->master, d->c.this_node_idx, d->lrc.vt, &notices, &count) < 0) {
+    print_err("acquire failed\n");
+    return -1;
+  }
+
+  log("Acquired %"PRIu32" write notices\n", count);
+  for (uint32_t i = 0; i < count; i++) {
+    if (notices[i].chunk_id >= NUM_CHUNKS)
+      continue;
+    if (dsm_diff_drop(d, notices[i].chunk_id, notices[i].page_offset) < 0)
+      error = -1;
+  }
+  free(notices);
+  return error;
+}
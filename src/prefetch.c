@@ -0,0 +1,162 @@
+/**
+ * Prefetching for the fault path. Decides, per chunk, which pages besides
+ * the faulting one should be fetched in the same GETPAGE request. Two
+ * predictors are used:
+ *   read-ahead - sequential faults fetch a growing window of following pages
+ *   stride     - faults at a constant stride (e.g. walking a matrix column)
+ *                fetch the next pages at that stride in batches
+ *
+ * The state lives in dsm_chunk_meta and is only touched by the thread
+ * servicing faults.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+#include "dsm.h"
+#include "dsm_internal.h"
+#include "prefetch.h"
+
+// equal fault distances seen in a row before the stride predictor kicks in
+#define DSM_STRIDE_CONFIDENCE   1
+
+/**
+ * Counts the pages at page_offset + i*stride (i = 1..max) which can be
+ * fetched, i.e. are inside the chunk and not mapped here yet. Chunks with
+ * large blocks get a smaller window; see DSM_FETCH_MAX_BLOCKS.
+ *
+ * @return 1 + the number of such pages before the first one which can not be fetched
+ */
+static
+uint32_t prefetch_window(dsm_chunk_meta *chunk_meta, dhandle page_offset,
+    int32_t stride, uint32_t max) {
+  int64_t num_pages = chunk_meta->count;
+  uint32_t npages = 1;
+
+  if (max >= DSM_FETCH_MAX_BLOCKS(chunk_meta->block_size))
+    max = DSM_FETCH_MAX_BLOCKS(chunk_meta->block_size) - 1;
+
+  while (npages <= max) {
+    int64_t next = (int64_t)page_offset + (int64_t)npages*stride;
+    if (next < 0 || next >= num_pages ||
+        dsm_chunk_page(chunk_meta, next)->page_prot != PROT_NONE)
+      break;
+    npages++;
+  }
+  return npages;
+}
+
+/**
+ * Sizes the read-ahead window for a read fault. A fault on the page right
+ * after the ones fetched by the previous fault continues a sequential stream
+ * and doubles the window; any other fault resets it. The window is cut at
+ * the end of the chunk and at the first page which is already mapped here.
+ *
+ * @param chunk_meta chunk the fault is in
+ * @param page_offset faulting page
+ * @return number of pages to fetch starting at page_offset; at least 1
+ */
+uint32_t dsm_readahead(dsm_chunk_meta *chunk_meta, dhandle page_offset) {
+  uint32_t window = 0;
+
+  if (page_offset == chunk_meta->ra_next) {
+    window = chunk_meta->ra_window ? 2*chunk_meta->ra_window : DSM_READAHEAD_MIN;
+    if (window > DSM_READAHEAD_MAX)
+      window = DSM_READAHEAD_MAX;
+  }
+  chunk_meta->ra_window = window;
+
+  uint32_t npages = prefetch_window(chunk_meta, page_offset, 1, window);
+  chunk_meta->ra_next = page_offset + npages;
+  return npages;
+}
+
+/**
+ * Feeds a read fault to the stride predictor. Once the distance between
+ * faults repeats, the next DSM_STRIDE_BATCH pages at that distance are
+ * fetched along with the faulting page. The fault after a batch should land
+ * right after it: that is counted as a hit, anything else as a miss.
+ *
+ * Sequential streams (a stride of one page) are left to the read-ahead.
+ *
+ * @param chunk_meta chunk the fault is in
+ * @param page_offset faulting page
+ * @param stride set to the stride to fetch at if more than one page is fetched
+ * @return number of pages to fetch; at least 1
+ */
+uint32_t dsm_stride_predict(dsm_chunk_meta *chunk_meta, dhandle page_offset, int32_t *stride) {
+  int64_t delta = (int64_t)page_offset - (int64_t)chunk_meta->st_last;
+  uint32_t npages = 1;
+
+  // the same page faulting again says nothing about the stream
+  if (delta == 0)
+    return npages;
+
+  if (chunk_meta->st_pending) {
+    if ((int64_t)page_offset == chunk_meta->st_next) {
+      chunk_meta->stride_hits++;
+      delta = chunk_meta->st_stride;
+    } else {
+      chunk_meta->stride_misses++;
+    }
+    chunk_meta->st_pending = 0;
+  }
+
+  if (delta == chunk_meta->st_stride) {
+    if (chunk_meta->st_confidence < DSM_STRIDE_CONFIDENCE)
+      chunk_meta->st_confidence++;
+  } else {
+    chunk_meta->st_stride = (delta > INT32_MAX || delta < INT32_MIN) ? 0 : (int32_t)delta;
+    chunk_meta->st_confidence = 0;
+  }
+  chunk_meta->st_last = page_offset;
+
+  int32_t st_stride = chunk_meta->st_stride;
+  if (chunk_meta->st_confidence < DSM_STRIDE_CONFIDENCE || (st_stride >= -1 && st_stride <= 1))
+    return npages;
+
+  npages = prefetch_window(chunk_meta, page_offset, st_stride, DSM_STRIDE_BATCH);
+  if (npages > 1) {
+    chunk_meta->st_pending = 1;
+    chunk_meta->st_next = (int64_t)page_offset + (int64_t)npages*st_stride;
+    *stride = st_stride;
+  }
+  return npages;
+}
+
+/**
+ * Picks the pages to fetch for a read fault: a read-ahead window if the
+ * fault continues a sequential stream, otherwise whatever the stride
+ * predictor suggests.
+ *
+ * @param stride set to the distance in pages between the pages to fetch
+ * @return number of pages to fetch starting at page_offset; at least 1
+ */
+uint32_t dsm_prefetch(dsm_chunk_meta *chunk_meta, dhandle page_offset, int32_t *stride) {
+  *stride = 1;
+  uint32_t npages = dsm_readahead(chunk_meta, page_offset);
+  if (npages > 1) {
+    // keep the stride predictor in step with the stream
+    chunk_meta->st_last = page_offset;
+    chunk_meta->st_pending = 0;
+    return npages;
+  }
+  return dsm_stride_predict(chunk_meta, page_offset, stride);
+}
+
+/**
+ * Updates the prefetch counters once the pages of a fault have been fetched.
+ *
+ * @param fetched number of pages fetched, including the faulting one
+ * @param stride the stride returned by dsm_prefetch
+ */
+void dsm_prefetch_account(dsm_chunk_meta *chunk_meta, uint32_t fetched, int32_t stride) {
+  if (fetched <= 1)
+    return;
+  if (stride == 1)
+    chunk_meta->readahead_pages += fetched - 1;
+  else
+    chunk_meta->stride_pages += fetched - 1;
+}
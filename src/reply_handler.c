@@ -21,9 +21,11 @@
 #include "strings.h"
 #include "dsm.h"
 #include "dsm_internal.h"
+#include "prefetch.h"
 #include "utils.h"
 
 extern struct dsm_map g_dsm_map[];
+extern dsm *g_dsm;
 extern int PAGESIZE;
 
 /**
@@ -62,15 +64,16 @@ void handle_allocchunk(comm *c, dsm_allocchunk_args *args) {
   log("Handling allocchunk for chunk %"PRIu64" from %s:%d\n", 
       args->chunk_id, args->requestor_host, args->requestor_port);
 
-  int is_owner = 0;
-  if ( (is_owner = dsm_allocchunk_internal(args->chunk_id, args->size, 
-      args->requestor_host, args->requestor_port)) < 0) {
+  int owner_idx = -1;
+  if (args->chunk_id >= NUM_CHUNKS ||
+      (owner_idx = dsm_allocchunk_internal(args->chunk_id, args->size, args->block_size,
+      args->flags, args->owner_idx, args->requestor_host, args->requestor_port)) < 0) {
       handle_error(c, DSM_EBADALLOC);
       return;
   }
 
   dsm_rep reply = make_reply(ALLOCCHUNK, .allocchunk_rep = {
-      .is_owner = is_owner
+      .owner_idx = owner_idx
   });
 
   // Send reply
@@ -133,8 +136,8 @@ void handle_locatepage(comm *c, dsm_locatepage_args *args) {
 
 
 /**
- * The GETPAGE handler.
- *
+ * The GETPAGE handler. The pages are copied once, under their page locks,
+ * into the message which goes out.
  *
  * @param sock the endpoint connected to the client
  * @param args the client's arguments
@@ -144,26 +147,255 @@ void handle_getpage(comm *c, dsm_getpage_args *args) {
   log("Handling getpage for chunk_id=%"PRIu64", page_offset=%"PRIu64", flags=%s host:port=%s:%d.\n", 
       args->chunk_id, args->page_offset, strflag(args->flags), args->requestor_host, args->requestor_port);
 
-  uint64_t count = PAGESIZE;
-  size_t reply_size = dsm_rep_size(getpage) + PAGESIZE;
-  dsm_rep *reply = (dsm_rep*)malloc(reply_size);
-  memset(reply, 0, reply_size);
+  if (args->chunk_id >= NUM_CHUNKS || g_dsm->g_dsm_page_map[args->chunk_id].count == 0) {
+    handle_error(c, DSM_ENOPAGE);
+    return;
+  }
+  uint32_t block_size = g_dsm->g_dsm_page_map[args->chunk_id].block_size;
+
+  uint32_t npages = args->npages;
+  if (npages == 0)
+    npages = 1;
+  if (npages > DSM_FETCH_MAX_BLOCKS(block_size))
+    npages = DSM_FETCH_MAX_BLOCKS(block_size);
+
+  // the pages are copied in below; only the part before them needs clearing
+  uint64_t count = block_size;
+  size_t reply_size = dsm_rep_size(getpage) + (size_t)npages*block_size;
+  dsm_rep *reply = (dsm_rep*)comm_alloc(c, reply_size);
+  if (reply == NULL) {
+    handle_error(c, DSM_EINTERNAL);
+    return;
+  }
+  memset(reply, 0, dsm_rep_size(getpage));
 
   uint8_t *data = reply->content.getpage_rep.data;
-  if (dsm_getpage_internal(args->chunk_id, args->page_offset, 
-    args->requestor_host, args->requestor_port, &data, &count, args->flags) < 0) {
+  uint32_t flags = 0;
+  int32_t owner_idx = -1;
+  uint64_t copyset = 0;
+  if (dsm_getpages_internal(args->chunk_id, args->page_offset, npages, args->stride,
+    args->requestor_host, args->requestor_port, &data, &count, args->flags, &flags,
+    &owner_idx, &copyset) < 0) {
     handle_error(c, DSM_ENOPAGE);
     goto cleanup_reply;
   }
   reply->type = GETPAGE;
   reply->content.getpage_rep.count = count;
-  
-  if(comm_send_data(c, reply, reply_size) < 0) {
+  reply->content.getpage_rep.flags = flags;
+  reply->content.getpage_rep.owner_idx = owner_idx;
+  reply->content.getpage_rep.copyset = copyset;
+
+  // only send the pages which were served
+  reply_size = dsm_rep_size(getpage) + count;
+  if(comm_send_msg(c, reply, reply_size) < 0) {
     print_err("Failed to send GETPAGE reply.\n");
   }
+  return;
 
 cleanup_reply:
-  free(reply);
+  comm_free(c, reply);
+}
+
+/**
+ * The PAGEDIFF handler.
+ *
+ * @param sock the endpoint connected to the client
+ * @param args the client's arguments
+ */
+void handle_pagediff(comm *c, dsm_pagediff_args *args) {
+  log("Handling pagediff for chunk_id=%"PRIu64", page_offset=%"PRIu64", size=%"PRIu32".\n",
+      args->chunk_id, args->page_offset, args->size);
+
+  uint64_t copyset = 0;
+  if (args->chunk_id >= NUM_CHUNKS ||
+      dsm_pagediff_internal(args->chunk_id, args->page_offset, args->node_idx,
+        args->data, args->size, &copyset) < 0) {
+    handle_error(c, DSM_EINTERNAL);
+    return;
+  }
+
+  dsm_rep reply = make_reply(PAGEDIFF, .pagediff_rep = {
+      .chunk_id = args->chunk_id,
+      .page_offset = args->page_offset,
+      .copyset = copyset,
+  });
+
+  // Send reply
+  if(comm_send_data(c, &reply, dsm_rep_size(pagediff)) < 0) {
+    print_err("Failed to send PAGEDIFF reply.\n");
+  }
+}
+
+/**
+ * The PAGEUPDATE handler.
+ *
+ * @param sock the endpoint connected to the client
+ * @param args the client's arguments
+ */
+void handle_pageupdate(comm *c, dsm_pagediff_args *args) {
+  log("Handling pageupdate for chunk_id=%"PRIu64", page_offset=%"PRIu64", size=%"PRIu32".\n",
+      args->chunk_id, args->page_offset, args->size);
+
+  if (args->chunk_id >= NUM_CHUNKS ||
+      dsm_pageupdate_internal(args->chunk_id, args->page_offset, args->data, args->size) < 0) {
+    handle_error(c, DSM_EINTERNAL);
+    return;
+  }
+
+  dsm_rep reply = make_reply(PAGEUPDATE, .pagediff_rep = {
+      .chunk_id = args->chunk_id,
+      .page_offset = args->page_offset,
+  });
+
+  // Send reply
+  if(comm_send_data(c, &reply, dsm_rep_size(pagediff)) < 0) {
+    print_err("Failed to send PAGEUPDATE reply.\n");
+  }
+}
+
+/**
+ * The PAGEDATA handler.
+ *
+ * @param sock the endpoint connected to the client
+ * @param args the client's arguments
+ */
+void handle_pagedata(comm *c, dsm_pagedata_args *args) {
+  log("Handling pagedata for chunk_id=%"PRIu64", page_offset=%"PRIu64", flags=%s.\n",
+      args->chunk_id, args->page_offset, strflag(args->flags));
+
+  if (args->chunk_id >= NUM_CHUNKS ||
+      dsm_pagedata_internal(args->chunk_id, args->page_offset, args->flags,
+        args->data, args->size) < 0) {
+    handle_error(c, DSM_EINTERNAL);
+    return;
+  }
+
+  dsm_rep reply = make_reply(PAGEDATA, .pagedata_rep = {
+      .chunk_id = args->chunk_id,
+      .page_offset = args->page_offset,
+  });
+
+  // Send reply
+  if(comm_send_data(c, &reply, dsm_rep_size(pagedata)) < 0) {
+    print_err("Failed to send PAGEDATA reply.\n");
+  }
+}
+
+/**
+ * The ACQUIRE handler. The write notices are copied once, into the
+ * message which goes out.
+ *
+ * @param sock the endpoint connected to the client
+ * @param args the client's arguments
+ */
+void handle_acquire(comm *c, dsm_acquire_args *args) {
+  log("Handling acquire for node %"PRIu32".\n", args->node_idx);
+
+  dsm_write_notice *notices = NULL;
+  uint32_t count = 0;
+  uint64_t seen[NUM_NODES], vt[NUM_NODES];
+  memcpy(seen, args->vt, sizeof(seen));
+  if (dsm_acquire_internal(args->node_idx, seen, vt, &notices, &count) < 0) {
+    handle_error(c, DSM_EINTERNAL);
+    return;
+  }
+
+  // the notices are copied in below; only the part before them needs clearing
+  size_t reply_size = dsm_rep_size(acquire) + count*sizeof(dsm_write_notice);
+  dsm_rep *reply = (dsm_rep*)comm_alloc(c, reply_size);
+  if (reply == NULL) {
+    handle_error(c, DSM_EINTERNAL);
+    goto cleanup_notices;
+  }
+  memset(reply, 0, dsm_rep_size(acquire));
+  reply->type = ACQUIRE;
+  memcpy(reply->content.acquire_rep.vt, vt, sizeof(vt));
+  reply->content.acquire_rep.count = count;
+  memcpy(reply->content.acquire_rep.notices, notices, count*sizeof(dsm_write_notice));
+
+  // Send reply
+  if(comm_send_msg(c, reply, reply_size) < 0) {
+    print_err("Failed to send ACQUIRE reply.\n");
+  }
+
+cleanup_notices:
+  free(notices);
+}
+
+/**
+ * The LOCK handler. Grants a free lock, or queues the node for it.
+ *
+ * @param sock the endpoint connected to the client
+ * @param args the client's arguments
+ */
+void handle_lock(comm *c, dsm_lock_args *args) {
+  log("Handling lock %"PRIu64" for node %"PRIu32".\n", args->lock_id, args->node_idx);
+
+  int granted;
+  if ((granted = dsm_lock_internal(args->lock_id, args->node_idx)) < 0) {
+    handle_error(c, DSM_EINTERNAL);
+    return;
+  }
+
+  dsm_rep reply = make_reply(LOCK, .lock_rep = {
+      .lock_id = args->lock_id,
+      .granted = granted,
+  });
+
+  // Send reply
+  if(comm_send_data(c, &reply, dsm_rep_size(lock)) < 0) {
+    print_err("Failed to send LOCK reply.\n");
+  }
+}
+
+/**
+ * The UNLOCK handler. Frees the lock, or names the node to hand it to.
+ *
+ * @param sock the endpoint connected to the client
+ * @param args the client's arguments
+ */
+void handle_unlock(comm *c, dsm_lock_args *args) {
+  log("Handling unlock %"PRIu64" for node %"PRIu32".\n", args->lock_id, args->node_idx);
+
+  int next_idx = -1;
+  if (dsm_unlock_internal(args->lock_id, args->node_idx, &next_idx) < 0) {
+    handle_error(c, DSM_EINTERNAL);
+    return;
+  }
+
+  dsm_rep reply = make_reply(UNLOCK, .unlock_rep = {
+      .lock_id = args->lock_id,
+      .next_idx = next_idx,
+  });
+
+  // Send reply
+  if(comm_send_data(c, &reply, dsm_rep_size(unlock)) < 0) {
+    print_err("Failed to send UNLOCK reply.\n");
+  }
+}
+
+/**
+ * The LOCKGRANT handler. The releasing node hands the lock over.
+ *
+ * @param sock the endpoint connected to the client
+ * @param args the client's arguments
+ */
+void handle_lockgrant(comm *c, dsm_lock_args *args) {
+  log("Handling lockgrant %"PRIu64" from node %"PRIu32".\n", args->lock_id, args->node_idx);
+
+  if (dsm_lockgrant_internal(args->lock_id) < 0) {
+    handle_error(c, DSM_EINTERNAL);
+    return;
+  }
+
+  dsm_rep reply = make_reply(LOCKGRANT, .lockgrant_rep = {
+      .lock_id = args->lock_id,
+  });
+
+  // Send reply
+  if(comm_send_data(c, &reply, dsm_rep_size(lockgrant)) < 0) {
+    print_err("Failed to send LOCKGRANT reply.\n");
+  }
 }
 
 /**
@@ -177,7 +409,8 @@ void handle_invalidatepage(comm *c, dsm_invalidatepage_args *args) {
   log("Handling invalidatepage for chunk_id=%"PRIu64", page_offset=%"PRIu64", host:port=%s:%d.\n",
       args->chunk_id, args->page_offset, args->requestor_host, args->requestor_port);
 
-  if (dsm_invalidatepage_internal(args->chunk_id, args->page_offset) < 0) {
+  if (dsm_invalidatepage_internal(args->chunk_id, args->page_offset,
+        args->requestor_host, args->requestor_port) < 0) {
     handle_error(c, DSM_EINTERNAL);
     return;
   }
@@ -21,12 +21,19 @@ int dsm_request_init(dsm_request *r, uint8_t *host, uint32_t port) {
   r->port = port;
 
   comm *c = &r->c;
-  if ((err = comm_init(c, 1)) < 0)
+  if ((err = comm_init_mux(c)) < 0)
     return err;
   
   if ((err = comm_connect(c, (char*)host, port)) < 0)
     return err;
 
+  r->calls = NULL;
+  r->next_id = 0;
+  r->receiving = 0;
+  if (pthread_mutex_init(&r->lock, NULL) != 0 ||
+      pthread_cond_init(&r->replied, NULL) != 0)
+    return -1;
+
   r->initialized = 1;
   return 0;
 }
@@ -35,40 +42,157 @@ int dsm_request_close(dsm_request *r) {
   if (r->initialized) {
     comm_shutdown(&r->c); 
     comm_close(&r->c);
+    pthread_cond_destroy(&r->replied);
+    pthread_mutex_destroy(&r->lock);
   }
   r->initialized = 0;
   return 0;
 }
 
 /**
- * Sends a request and waits for a reply. If flags is zero, we wait forever for
- * a reply. If flags == NN_DONTWAIT, we wait about a second and then return
- * NULL. Returns the reply if there was one and it wasn't an ERROR.
- *
- * @param sock the socket to send the request to
- * @param url the url to send the request to
- * @param request the request to send
- * @param size the size of the request
- * @param @deprecated flags flags == NN_DONTWAIT, we wait about a second for a response,
- *              otherwise, the wait could be forever
+ * Takes the call with the given id off the calls in flight.
+ * r->lock should be held.
  *
- * @return reply is successful, NULL otherwise
+ * @return the call; NULL if there is none with this id
  */
-dsm_rep *dsm_request_req_rep_f(dsm_request *r, dsm_req *request,
-    size_t size) {
+static
+dsm_call *dsm_request_unlink(dsm_request *r, uint32_t id) {
+  for (dsm_call **p = &r->calls; *p != NULL; p = &(*p)->next) {
+    if ((*p)->id == id) {
+      dsm_call *call = *p;
+      *p = call->next;
+      return call;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * dsm_request_start for a request which ends in a payload kept elsewhere,
+ * such as a page; the payload is sent from where it is.
+ */
+static
+int dsm_request_start_gather(dsm_request *r, dsm_call *call, dsm_req *request,
+    size_t size, const uint8_t *payload, size_t payload_size) {
   assert(r);
   assert(r->c.sock >= 0);
   assert(request);
 
   debug("Sending request '%s' to '%s:%d'\n", strmsgtype(request->type), r->host, r->port);
 
-  // Send the request. If it fails, close the connection and return NULL.
-  if (comm_send_data(&r->c, request, size) < 0) {
-    return NULL;
+  call->type = request->type;
+  call->done = 0;
+  call->reply = NULL;
+
+  // in the list before it goes out; the reply may be received right away
+  pthread_mutex_lock(&r->lock);
+  call->id = r->next_id++ & 0x7fffffff;
+  call->next = r->calls;
+  r->calls = call;
+  pthread_mutex_unlock(&r->lock);
+
+  if (comm_send_tagged(&r->c, call->id, request, size, payload, payload_size) < 0) {
+    dsm_request_cancel(r, call);
+    return -1;
   }
+  return 0;
+}
 
-  // Wait for a reply.
-  dsm_rep *reply = (dsm_rep*)comm_receive_data(&r->c, NULL);
+/**
+ * Sends a request without waiting for the reply. Any number of requests
+ * may be in flight on a dsm_request; the reply to this one is picked up
+ * with dsm_request_finish, or dsm_request_next. The call should stay
+ * around until then.
+ *
+ * @return 0 on success, < 0 on error
+ */
+int dsm_request_start(dsm_request *r, dsm_call *call, dsm_req *request, size_t size) {
+  return dsm_request_start_gather(r, call, request, size, NULL, 0);
+}
+
+/**
+ * Gives up on a call; a reply to it which comes in later is dropped.
+ */
+void dsm_request_cancel(dsm_request *r, dsm_call *call) {
+  pthread_mutex_lock(&r->lock);
+  dsm_request_unlink(r, call->id);
+  if (call->reply != NULL)
+    comm_free(&r->c, call->reply);
+  call->reply = NULL;
+  call->done = 1;
+  pthread_mutex_unlock(&r->lock);
+}
+
+/**
+ * Receives one reply and hands it to its call. r->lock should be held; it
+ * is dropped while receiving, and the other threads wait meanwhile.
+ *
+ * @param call set to the call the reply was for; NULL if nobody waits for it
+ * @return 0 on success; -1 if no reply was received
+ */
+static
+int dsm_request_receive(dsm_request *r, dsm_call **call) {
+  uint32_t id;
+  r->receiving = 1;
+  pthread_mutex_unlock(&r->lock);
+  dsm_rep *reply = (dsm_rep*)comm_receive_tagged(&r->c, &id, NULL);
+  pthread_mutex_lock(&r->lock);
+  r->receiving = 0;
+  pthread_cond_broadcast(&r->replied);
+
+  *call = NULL;
+  if (reply == NULL)
+    return -1;
+  if ((*call = dsm_request_unlink(r, id)) == NULL) {
+    debug("Dropping reply to request %u\n", id);
+    comm_free(&r->c, reply);
+    return 0;
+  }
+  (*call)->reply = reply;
+  (*call)->done = 1;
+  return 0;
+}
+
+/**
+ * Receives the next reply on a dsm_request and hands it to its call, for
+ * a thread which polls comm_receive_fd of several connections rather than
+ * wait on one call. Its reply is then taken with dsm_request_finish.
+ *
+ * @param call set to the call which completed; NULL if nobody waits for it
+ * @return 0 on success; -1 if no reply was received
+ */
+int dsm_request_next(dsm_request *r, dsm_call **call) {
+  pthread_mutex_lock(&r->lock);
+  while (r->receiving)
+    pthread_cond_wait(&r->replied, &r->lock);
+  int error = dsm_request_receive(r, call);
+  pthread_mutex_unlock(&r->lock);
+  return error;
+}
+
+/**
+ * Waits for the reply to a request sent with dsm_request_start. While no
+ * other thread receives on the dsm_request this one does, and hands the
+ * replies to the other calls to their threads.
+ *
+ * @return reply is successful, NULL otherwise
+ */
+dsm_rep *dsm_request_finish(dsm_request *r, dsm_call *call) {
+  dsm_call *done;
+
+  pthread_mutex_lock(&r->lock);
+  while (!call->done) {
+    if (r->receiving) {
+      pthread_cond_wait(&r->replied, &r->lock);
+    } else if (dsm_request_receive(r, &done) < 0 && !call->done) {
+      dsm_request_unlink(r, call->id);
+      call->done = 1;
+    }
+  }
+  pthread_mutex_unlock(&r->lock);
+
+  dsm_rep *reply = call->reply;
+  call->reply = NULL;
 
   // No reply? Well, okay. Return NULL.
   if (!reply) {
@@ -76,7 +200,7 @@ dsm_rep *dsm_request_req_rep_f(dsm_request *r, dsm_req *request,
     return NULL;
   }
 
-  if (reply->type != request->type) {
+  if (reply->type != call->type) {
     debug("Bad reply type: %s (%d).\n", strmsgtype(reply->type), reply->type);
     comm_free(&r->c, reply);
     return NULL;
@@ -93,6 +217,24 @@ dsm_rep *dsm_request_req_rep_f(dsm_request *r, dsm_req *request,
   return reply;
 }
 
+/**
+ * Sends a request and waits for a reply. Returns the reply if there was
+ * one and it wasn't an ERROR. Other threads may have requests in flight on
+ * the same dsm_request meanwhile.
+ *
+ * @param request the request to send
+ * @param size the size of the request
+ *
+ * @return reply is successful, NULL otherwise
+ */
+dsm_rep *dsm_request_req_rep_f(dsm_request *r, dsm_req *request,
+    size_t size) {
+  dsm_call call;
+  if (dsm_request_start(r, &call, request, size) < 0)
+    return NULL;
+  return dsm_request_finish(r, &call);
+}
+
 /**
  * The same as dsm_req_rep, but always waits forever for a response.
  *
@@ -111,10 +253,22 @@ dsm_rep *dsm_request_req_rep(dsm_request *r, dsm_req *req, size_t size) {
   return dsm_request_req_rep_f(r, req, size);
 }
 
-int dsm_request_allocchunk(dsm_request *r, dhandle chunk_id, size_t size, uint8_t *host, uint32_t port) {
+/**
+ * The ALLOCCHUNK request. Sent to the master to allocate a chunk, and
+ * then to every node to set it up.
+ *
+ * @param owner_idx node the pages start out with, as the master replied;
+ *        -1 when asking the master
+ * @return the node the pages start out with; < 0 on error
+ */
+int dsm_request_allocchunk(dsm_request *r, dhandle chunk_id, size_t size,
+    uint32_t block_size, uint32_t flags, int32_t owner_idx, uint8_t *host, uint32_t port) {
   dsm_req req = make_request(ALLOCCHUNK, .allocchunk_args = {
     .chunk_id = chunk_id,
     .size = size,
+    .block_size = block_size,
+    .flags = flags,
+    .owner_idx = owner_idx,
     .requestor_port = port,
   });
 
@@ -130,7 +284,9 @@ int dsm_request_allocchunk(dsm_request *r, dhandle chunk_id, size_t size, uint8_
 
   log("Received allocchunk response.\n\n");
 
-  return rep->content.allocchunk_rep.is_owner;
+  owner_idx = rep->content.allocchunk_rep.owner_idx;
+  comm_free(&r->c, rep);
+  return owner_idx;
 }
 
 int dsm_request_freechunk(dsm_request *r, dhandle chunk_id, 
@@ -186,12 +342,32 @@ int dsm_request_locatepage(dsm_request *r, dhandle chunk_id,
 /**
  * The GETPAGE request.
  *
+ * @param len room in page_start_addr; the block size of the chunk
+ * @param rep_flags set to the flags of the reply, if not NULL
  * @return 0 on success, < 0 (a -errno) on error
  */
-int dsm_request_getpage(dsm_request *r, dhandle chunk_id, 
-    dhandle page_offset, uint8_t *host, uint32_t port, 
-    uint8_t **page_start_addr, uint32_t flags) {
-  log("Sending getpage %"PRIu64", %"PRIu64" to %s:%d\n", chunk_id, page_offset, r->host, r->port);
+int dsm_request_getpage(dsm_request *r, dhandle chunk_id,
+    dhandle page_offset, uint8_t *host, uint32_t port,
+    uint8_t **page_start_addr, size_t len, uint32_t flags, uint32_t *rep_flags) {
+  if (dsm_request_getpages(r, chunk_id, page_offset, 1, 1, host, port,
+        page_start_addr, len, flags, rep_flags) < 0)
+    return -1;
+  return 0;
+}
+
+/**
+ * Sends the GETPAGE request for the page at page_offset followed by up to
+ * npages-1 prefetched pages at page_offset + i*stride. The reply is picked
+ * up with dsm_request_getpages_recv.
+ *
+ * @param call stands for the request until the reply is picked up
+ * @return 0 on success, < 0 on error
+ */
+int dsm_request_getpages_send(dsm_request *r, dsm_call *call, dhandle chunk_id,
+    dhandle page_offset, uint32_t npages, int32_t stride, uint8_t *host, uint32_t port,
+    uint32_t flags) {
+  log("Sending getpage %"PRIu64", %"PRIu64" (%"PRIu32" pages, stride %"PRId32") to %s:%d\n",
+      chunk_id, page_offset, npages, stride, r->host, r->port);
   size_t host_len = strlen((char*)host) + 1;
   size_t req_size = dsm_req_size(getpage) + host_len*sizeof(uint8_t); 
   dsm_req *req = (dsm_req*)malloc(req_size);
@@ -202,48 +378,250 @@ int dsm_request_getpage(dsm_request *r, dhandle chunk_id,
   args->chunk_id = chunk_id,
   args->page_offset = page_offset,
   args->flags = flags,
+  args->npages = npages,
+  args->stride = stride,
   args->requestor_port = port,
   memcpy(args->requestor_host, host, host_len);
 
+  int error = dsm_request_start(r, call, req, req_size);
+  free(req);
+  return error;
+}
+
+/**
+ * Waits for the reply to dsm_request_getpages_send. The pages are in
+ * rep->content.getpage_rep.data; the reply may carry fewer pages than asked
+ * for. The reply should be freed with comm_free.
+ *
+ * @return reply on success, NULL on error
+ */
+dsm_rep *dsm_request_getpages_recv(dsm_request *r, dsm_call *call) {
+  dsm_rep *rep = dsm_request_finish(r, call);
+  if (rep == NULL) {
+    log("Received NULL reply for getpage from %s:%d\n", r->host, r->port);
+    return NULL;
+  }
+
+  log("Received getpage data=\"%p\", bytes=%"PRIu64"\n",
+         rep->content.getpage_rep.data,
+         rep->content.getpage_rep.count);
+  return rep;
+}
+
+/**
+ * The GETPAGE request for the page at page_offset followed by up to
+ * npages-1 prefetched pages at page_offset + i*stride. The reply may carry
+ * fewer pages than asked for.
+ *
+ * @param len room in page_start_addr; npages times the block size of the chunk
+ * @param rep_flags set to the flags of the reply, if not NULL
+ * @return number of bytes received on success, < 0 on error
+ */
+int dsm_request_getpages(dsm_request *r, dhandle chunk_id,
+    dhandle page_offset, uint32_t npages, int32_t stride, uint8_t *host, uint32_t port,
+    uint8_t **page_start_addr, size_t len, uint32_t flags, uint32_t *rep_flags) {
+  if (!r->initialized)
+    return -1;
+
+  dsm_call call;
+  dsm_rep *rep = NULL;
+  if (dsm_request_getpages_send(r, &call, chunk_id, page_offset, npages, stride,
+        host, port, flags) == 0)
+    rep = dsm_request_getpages_recv(r, &call);
+  if (rep == NULL)
+    return -1;
+  if (rep_flags != NULL)
+    *rep_flags = rep->content.getpage_rep.flags;
+
+  if (rep->content.getpage_rep.flags & FLAG_PAGE_NOUPDATE) {
+    log("Received getpage for owned page\n");
+    comm_free(&r->c, rep);
+    return len;
+  }
+
+  uint64_t count = rep->content.getpage_rep.count;
+  if (count > len)
+    count = len;
+  memcpy(*page_start_addr, rep->content.getpage_rep.data, count);
+
+  comm_free(&r->c, rep);
+  return count;
+}
+
+/**
+ * Sends the diff of a page; PAGEDIFF to the home or PAGEUPDATE to a reader.
+ *
+ * @param copyset set to the copyset in the reply, if not NULL
+ * @return 0 on success; -1 in case of error
+ */
+static
+int dsm_request_diff(dsm_request *r, dsm_msg_type type, dhandle chunk_id, dhandle page_offset,
+    uint32_t node_idx, const uint8_t *diff, uint32_t size, uint64_t *copyset) {
+  size_t req_size = dsm_req_size(pagediff) + size*sizeof(uint8_t);
+  dsm_req *req = (dsm_req*)malloc(req_size);
+  memset(req, 0, req_size);
+  req->type = type;
+
+  dsm_pagediff_args *args = &req->content.pagediff_args;
+  args->chunk_id = chunk_id;
+  args->page_offset = page_offset;
+  args->node_idx = node_idx;
+  args->size = size;
+  memcpy(args->data, diff, size);
+
+  log("Sending %s %"PRIu64", %"PRIu64" of %"PRIu32" bytes to %s:%d\n",
+      strmsgtype(type), chunk_id, page_offset, size, r->host, r->port);
+
   dsm_rep *rep = dsm_request_req_rep(r, req, req_size);
   free(req);
-  
+
   if (rep == NULL) {
-    log("Received NULL reply for getpage %"PRIu64", %"PRIu64", %s:%d\n",
-        chunk_id, page_offset, host, port);
     return -1;
   }
+  if (copyset != NULL)
+    *copyset = rep->content.pagediff_rep.copyset;
+  comm_free(&r->c, rep);
+  return 0;
+}
 
-  if (flags & FLAG_PAGE_NOUPDATE) {
-    log("Received getpage for owned page\n");
-    return 0;
+int dsm_request_pagediff(dsm_request *r, dhandle chunk_id, dhandle page_offset,
+    uint32_t node_idx, const uint8_t *diff, uint32_t size, uint64_t *copyset) {
+  return dsm_request_diff(r, PAGEDIFF, chunk_id, page_offset, node_idx, diff, size, copyset);
+}
+
+int dsm_request_pageupdate(dsm_request *r, dhandle chunk_id, dhandle page_offset,
+    uint32_t node_idx, const uint8_t *diff, uint32_t size) {
+  return dsm_request_diff(r, PAGEUPDATE, chunk_id, page_offset, node_idx, diff, size, NULL);
+}
+
+/**
+ * Sends a page to the node whose fault on it the manager forwarded to
+ * this node, the owner; see dsm_pagedata_internal.
+ *
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_request_pagedata(dsm_request *r, dhandle chunk_id, dhandle page_offset,
+    uint32_t flags, const uint8_t *data, uint32_t size) {
+  if (!r->initialized)
+    return -1;
+
+  dsm_req req = make_request(PAGEDATA, .pagedata_args = {
+    .chunk_id = chunk_id,
+    .page_offset = page_offset,
+    .flags = flags,
+    .size = size,
+  });
+
+  log("Sending pagedata %"PRIu64", %"PRIu64" to %s:%d\n", chunk_id, page_offset, r->host, r->port);
+
+  // the page follows the arguments on the wire, gathered from data
+  dsm_call call;
+  dsm_rep *rep = NULL;
+  if (dsm_request_start_gather(r, &call, &req, dsm_req_size(pagedata), data, size) == 0)
+    rep = dsm_request_finish(r, &call);
+
+  if (rep == NULL) {
+    return -1;
   }
+  comm_free(&r->c, rep);
+  return 0;
+}
 
-  log("Received getpage data=\"%p\", bytes=%"PRIu64"\n", 
-         rep->content.getpage_rep.data,
-         rep->content.getpage_rep.count); 
-  
-  memcpy(*page_start_addr, rep->content.getpage_rep.data,
-         PAGESIZE);
+/**
+ * Asks the master for the write notices this node has not seen yet.
+ *
+ * @param vt write notices of each node seen so far; updated on return
+ * @param notices set to a malloc'ed array of the new notices
+ * @param count set to the number of new notices
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_request_acquire(dsm_request *r, uint32_t node_idx, uint64_t *vt,
+    dsm_write_notice **notices, uint32_t *count) {
+  dsm_req req = make_request(ACQUIRE, .acquire_args = {
+    .node_idx = node_idx,
+  });
+  memcpy(req.content.acquire_args.vt, vt, sizeof(req.content.acquire_args.vt));
+
+  log("Sending acquire to %s:%d\n", r->host, r->port);
+  dsm_rep *rep = dsm_request_req_rep(r, &req, dsm_req_size(acquire));
+  if (rep == NULL) {
+    return -1;
+  }
 
+  dsm_acquire_rep *acquire_rep = &rep->content.acquire_rep;
+  size_t size = acquire_rep->count*sizeof(dsm_write_notice);
+  *notices = (dsm_write_notice*)malloc(size ? size : 1);
+  memcpy(*notices, acquire_rep->notices, size);
+  *count = acquire_rep->count;
+  memcpy(vt, acquire_rep->vt, sizeof(acquire_rep->vt));
   comm_free(&r->c, rep);
   return 0;
 }
 
 /**
- * The INVALIDATEPAGE request.
+ * Asks the lock manager for a lock.
  *
- * @return 0 on success, < 0 (a -errno) on error
+ * @return 1 if the lock was granted; 0 if the node was queued for it; -1 in case of error
  */
-int dsm_request_invalidatepage(dsm_request *r, dhandle chunk_id,
-    dhandle page_offset, uint8_t *host, uint32_t port, uint32_t flags) {
-  UNUSED(host);
-  UNUSED(port);
+int dsm_request_lock(dsm_request *r, dhandle lock_id, uint32_t node_idx) {
+  dsm_req req = make_request(LOCK, .lock_args = {
+    .lock_id = lock_id,
+    .node_idx = node_idx,
+  });
+  dsm_rep *rep = dsm_request_req_rep(r, &req, dsm_req_size(lock));
+  if (rep == NULL) {
+    return -1;
+  }
+  int granted = rep->content.lock_rep.granted;
+  comm_free(&r->c, rep);
+  return granted;
+}
 
+/**
+ * Gives a lock back to the lock manager.
+ *
+ * @return node to hand the lock to; -1 if nobody waits for it; < -1 in case of error
+ */
+int dsm_request_unlock(dsm_request *r, dhandle lock_id, uint32_t node_idx) {
+  dsm_req req = make_request(UNLOCK, .lock_args = {
+    .lock_id = lock_id,
+    .node_idx = node_idx,
+  });
+  dsm_rep *rep = dsm_request_req_rep(r, &req, dsm_req_size(lock));
+  if (rep == NULL) {
+    return -2;
+  }
+  int next_idx = rep->content.unlock_rep.next_idx;
+  comm_free(&r->c, rep);
+  return next_idx;
+}
+
+/**
+ * Hands a lock over to a node waiting for it.
+ *
+ * @param r the waiting node
+ * @return 0 on success; -1 in case of error
+ */
+int dsm_request_lockgrant(dsm_request *r, dhandle lock_id, uint32_t node_idx) {
+  dsm_req req = make_request(LOCKGRANT, .lock_args = {
+    .lock_id = lock_id,
+    .node_idx = node_idx,
+  });
+  dsm_rep *rep = dsm_request_req_rep(r, &req, dsm_req_size(lock));
+  if (rep == NULL) {
+    return -1;
+  }
+  comm_free(&r->c, rep);
+  return 0;
+}
+
+static
+dsm_req *dsm_request_invalidatepage_make(dhandle chunk_id, dhandle page_offset,
+    uint8_t *host, uint32_t port, uint32_t flags, size_t *req_size) {
   size_t host_len = strlen((char*)host) + 1;
-  size_t req_size = dsm_req_size(invalidatepage) + host_len*sizeof(uint8_t); 
-  dsm_req *req = (dsm_req*)malloc(req_size);
-  memset(req, 0, req_size);  
+  *req_size = dsm_req_size(invalidatepage) + host_len*sizeof(uint8_t); 
+  dsm_req *req = (dsm_req*)malloc(*req_size);
+  memset(req, 0, *req_size);  
   req->type = INVALIDATEPAGE;
   
   dsm_invalidatepage_args *args = &req->content.invalidatepage_args;
@@ -252,7 +630,19 @@ int dsm_request_invalidatepage(dsm_request *r, dhandle chunk_id,
   args->flags = flags,
   args->requestor_port = port,
   memcpy(args->requestor_host, host, host_len);
- 
+  return req;
+}
+
+/**
+ * The INVALIDATEPAGE request.
+ *
+ * @return 0 on success, < 0 (a -errno) on error
+ */
+int dsm_request_invalidatepage(dsm_request *r, dhandle chunk_id,
+    dhandle page_offset, uint8_t *host, uint32_t port, uint32_t flags) {
+  size_t req_size;
+  dsm_req *req = dsm_request_invalidatepage_make(chunk_id, page_offset,
+      host, port, flags, &req_size);
 
   log("Sending invalidatepage %"PRIu64", %"PRIu64" to %s:%d\n", chunk_id, page_offset, r->host, r->port);
 
@@ -266,6 +656,67 @@ int dsm_request_invalidatepage(dsm_request *r, dhandle chunk_id,
   return 0;
 }
 
+/**
+ * Sends a request to several nodes at once. It goes out to all of them
+ * before the first reply is waited for, so asking many nodes takes about
+ * as long as asking one.
+ *
+ * @param peers the dsm_requests of all nodes
+ * @param targets the nodes to send to, bit i for node i
+ * @return 0 on success; -1 if a node did not reply
+ */
+static
+int dsm_request_fanout(dsm_request *peers, int num_nodes, uint64_t targets,
+    dsm_req *req, size_t req_size) {
+  dsm_call calls[num_nodes];
+  uint64_t sent = 0;
+  int error = 0;
+
+  for (int i = 0; i < num_nodes; i++) {
+    if (!(targets & (1ULL << i)))
+      continue;
+    dsm_request *r = &peers[i];
+    log("Sending %s to %s:%d\n", strmsgtype(req->type), r->host, r->port);
+    if (r->initialized && dsm_request_start(r, &calls[i], req, req_size) == 0)
+      sent |= 1ULL << i;
+    else
+      error = -1;
+  }
+
+  for (int i = 0; i < num_nodes; i++) {
+    if (!(sent & (1ULL << i)))
+      continue;
+    dsm_rep *rep = dsm_request_finish(&peers[i], &calls[i]);
+    if (rep != NULL)
+      comm_free(&peers[i].c, rep);
+    else
+      error = -1;
+  }
+  return error;
+}
+
+/**
+ * The INVALIDATEPAGE request to several nodes at once.
+ *
+ * @param peers the dsm_requests of all nodes
+ * @param targets the nodes to send to, bit i for node i
+ * @return 0 on success; -1 if a node did not ack
+ */
+int dsm_request_invalidatepages(dsm_request *peers, int num_nodes,
+    uint64_t targets, dhandle chunk_id, dhandle page_offset, uint8_t *host,
+    uint32_t port, uint32_t flags) {
+  if (targets == 0)
+    return 0;
+
+  size_t req_size;
+  dsm_req *req = dsm_request_invalidatepage_make(chunk_id, page_offset,
+      host, port, flags, &req_size);
+  log("Invalidating %"PRIu64", %"PRIu64" on nodes %#"PRIx64"\n", chunk_id, page_offset, targets);
+  int error = dsm_request_fanout(peers, num_nodes, targets, req, req_size);
+  free(req);
+  return error;
+}
+
 int dsm_request_barrier(dsm_request *r) {
   dsm_req req = make_request(BARRIER, .barrier_args = {.tmp=1});
   dsm_rep *rep = dsm_request_req_rep(r, &req, dsm_req_size(barrier));
@@ -276,6 +727,18 @@ int dsm_request_barrier(dsm_request *r) {
   return 0;
 }
 
+/**
+ * The BARRIER request to several nodes at once.
+ *
+ * @param clients the dsm_requests of all nodes
+ * @param targets the nodes to send to, bit i for node i
+ * @return 0 on success; -1 if a node did not reply
+ */
+int dsm_request_barriers(dsm_request *clients, int num_nodes, uint64_t targets) {
+  dsm_req req = make_request(BARRIER, .barrier_args = {.tmp=1});
+  return dsm_request_fanout(clients, num_nodes, targets, &req, dsm_req_size(barrier));
+}
+
 int dsm_request_terminate(dsm_request *r, uint8_t *requestor_host, uint32_t requestor_port) {
   dsm_req req = make_request(TERMINATE, .terminate_args = {
       .requestor_port = requestor_port,
@@ -8,7 +8,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <inttypes.h>
 
 #ifdef __linux__
 #include <bsd/stdlib.h>
@@ -21,6 +25,7 @@
 #include "strings.h"
 #include "request.h"
 #include "reply_handler.h"
+#include "dsm_internal.h"
 #include "server.h"
 
 // The URL to serve at - the port should probably be a command line argument
@@ -37,14 +42,154 @@ int dsm_server_init(dsm_server *c, const char *host, uint32_t port) {
   UNUSED(host);
   c->port = port;
   c->terminated = 0;
+  c->park = 0;
+  c->wake_fd = -1;
+  c->parked = NULL;
+  c->parked_tail = &c->parked;
   return 0;
 }
 
+/**
+ * Lets the server park the GETPAGEs for busy pages rather than wait for
+ * them; it answers them once their pages are released. Call before
+ * dsm_server_start.
+ *
+ * @returns 0 on success; -1 on failure
+ */
+int dsm_server_park(dsm_server *c) {
+  c->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (c->wake_fd < 0) {
+    print_err("Failed to create the wake up fd: %s\n", strerror(errno));
+    return -1;
+  }
+  c->park = 1;
+  return 0;
+}
+
+/**
+ * Wakes the server up to try its parked requests again. Called by the
+ * holder of a page with requests parked on it, once it releases the page.
+ */
+void dsm_server_wake(dsm_server *c) {
+  uint64_t one = 1;
+  if (c->wake_fd >= 0 && write(c->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    print_err("Failed to wake the server up: %s\n", strerror(errno));
+}
+
 int dsm_server_close(dsm_server *c) {
   c->terminated = 1;
   return 0;
 }
 
+/**
+ * Dispatches a request to its handler, or parks it (see dsm_server_start).
+ *
+ * @return 1 if the request was parked and is kept; 0 if it was handled
+ */
+static
+int dsm_server_handle(dsm_server *s, comm *c, dsm_req *req, ssize_t bytes) {
+  dsm_msg_type msg_type = ERROR;
+  if ((size_t) bytes >= sizeof(dsm_msg_type)) {
+    msg_type = req->type;
+  }
+
+  log("\n\nReceived '%s' request.\n", strmsgtype(msg_type));
+  switch (req->type) {
+    case ALLOCCHUNK:
+      handle_allocchunk(c, &req->content.allocchunk_args);
+      break;
+    case FREECHUNK:
+      handle_freechunk(c, &req->content.freechunk_args);
+      break;
+    case GETPAGE:
+      if (s->park && dsm_page_park(req->content.getpage_args.chunk_id,
+            req->content.getpage_args.page_offset,
+            req->content.getpage_args.requestor_host,
+            req->content.getpage_args.requestor_port)) {
+        dsm_parked *p = (dsm_parked*)malloc(sizeof(dsm_parked));
+        if (p != NULL) {
+          p->next = NULL;
+          p->req = req;
+          p->size = bytes;
+          p->hdr_size = c->hdr_size;
+          memcpy(p->hdr, c->hdr, c->hdr_size);
+          *s->parked_tail = p;
+          s->parked_tail = &p->next;
+          return 1;
+        }
+        // served right away, blocking until the page is released
+        print_err("Could not park getpage for chunk_id=%"PRIu64", page_offset=%"PRIu64"\n",
+            req->content.getpage_args.chunk_id, req->content.getpage_args.page_offset);
+      }
+      handle_getpage(c, &req->content.getpage_args);
+      break;
+    case LOCATEPAGE:
+      handle_locatepage(c, &req->content.locatepage_args);
+      break;
+    case INVALIDATEPAGE:
+      handle_invalidatepage(c, &req->content.invalidatepage_args);
+      break;
+     case TERMINATE:
+      handle_terminate(c, &req->content.terminate_args);
+      s->terminated = 1;
+      break;
+    case BARRIER:
+      handle_barrier(c, &req->content.barrier_args);
+      break;
+    case PAGEDIFF:
+      handle_pagediff(c, &req->content.pagediff_args);
+      break;
+    case ACQUIRE:
+      handle_acquire(c, &req->content.acquire_args);
+      break;
+    case PAGEUPDATE:
+      handle_pageupdate(c, &req->content.pageupdate_args);
+      break;
+    case PAGEDATA:
+      handle_pagedata(c, &req->content.pagedata_args);
+      break;
+    case LOCK:
+      handle_lock(c, &req->content.lock_args);
+      break;
+    case UNLOCK:
+      handle_unlock(c, &req->content.lock_args);
+      break;
+    case LOCKGRANT:
+      handle_lockgrant(c, &req->content.lock_args);
+      break;
+    default:
+      handle_unimplemented(c, msg_type);
+      break;
+  }
+  log("Sent response\n");
+  log("\n");
+  return 0;
+}
+
+/**
+ * Tries the parked requests again, in the order they came in. Those whose
+ * pages are still busy are parked again.
+ */
+static
+void dsm_server_unpark(dsm_server *s, comm *c) {
+  uint64_t count;
+  if (read(s->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    print_err("Failed to read the wake up fd: %s\n", strerror(errno));
+
+  dsm_parked *p = s->parked;
+  s->parked = NULL;
+  s->parked_tail = &s->parked;
+  while (p != NULL) {
+    dsm_parked *next = p->next;
+    c->hdr_size = p->hdr_size;
+    memcpy(c->hdr, p->hdr, p->hdr_size);
+    if (!dsm_server_handle(s, c, p->req, p->size))
+      comm_free(c, p->req);
+    free(p);
+    p = next;
+  }
+}
+
 /**
  * The main server loop.
  *
@@ -52,6 +197,12 @@ int dsm_server_close(dsm_server *c) {
  * is making, and dispatches the request to respective handlers, passing it the
  * request's parameters.
  *
+ * A server set up with dsm_server_park does not wait for a busy page: the
+ * GETPAGE is put aside and the server goes on with other requests. The
+ * holder of the page wakes the server up once it releases it, and the
+ * reply goes out then; its socket is a raw REP socket, which answers
+ * requests in any order.
+ *
  * @param url the nanomsg formatted URL the server should listen at
  */
 int dsm_server_start(dsm_server *s) {
@@ -59,7 +210,7 @@ int dsm_server_start(dsm_server *s) {
   int error;
 
   // passing 0 as second argument because we will be receiving and replying to requests.
-  if ((error = comm_init(&c, 0)) < 0)
+  if ((error = s->park ? comm_init_mux_rep(&c) : comm_init(&c, 0)) < 0)
     return error;
 
   if ((error = comm_bind(&c, s->port)) < 0)
@@ -68,8 +219,25 @@ int dsm_server_start(dsm_server *s) {
   // okay, it all checks out. Let's loop, waiting for a message.
   debug( "DSM listening on %d...\n", s->port);
 
+  struct pollfd fds[2] = {
+    { .fd = comm_receive_fd(&c), .events = POLLIN },
+    { .fd = s->wake_fd, .events = POLLIN },
+  };
+  if (fds[0].fd < 0)
+    return -1;
+
   dsm_req *req = NULL;
   while (!s->terminated) {
+    if (poll(fds, s->park ? 2 : 1, 60000) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (s->park && (fds[1].revents & POLLIN))
+      dsm_server_unpark(s, &c);
+    if (!(fds[0].revents & POLLIN))
+      continue;
+
     ssize_t bytes = 0;
     req = comm_receive_data(&c, &bytes);
     if (req == NULL) {
@@ -77,42 +245,8 @@ int dsm_server_start(dsm_server *s) {
       continue;
     }
 
-    dsm_msg_type msg_type = ERROR;
-    if ((size_t) bytes >= sizeof(dsm_msg_type)) {
-      msg_type = req->type;
-    }
-
-    log("\n\nReceived '%s' request.\n", strmsgtype(msg_type));
-    switch (req->type) {
-      case ALLOCCHUNK:
-        handle_allocchunk(&c, &req->content.allocchunk_args);
-        break;
-      case FREECHUNK:
-        handle_freechunk(&c, &req->content.freechunk_args);
-        break;
-      case GETPAGE:
-        handle_getpage(&c, &req->content.getpage_args);
-        break;
-      case LOCATEPAGE:
-        handle_locatepage(&c, &req->content.locatepage_args);
-        break;
-      case INVALIDATEPAGE:
-        handle_invalidatepage(&c, &req->content.invalidatepage_args);
-        break;
-       case TERMINATE:
-        handle_terminate(&c, &req->content.terminate_args);
-        break;
-      case BARRIER:
-        handle_barrier(&c, &req->content.barrier_args);
-        break;
-      default:
-        handle_unimplemented(&c, msg_type);
-        break;
-    }
-    log("Sent response\n");
-    log("\n");
-
-    comm_free(&c, req);
+    if (!dsm_server_handle(s, &c, req, bytes))
+      comm_free(&c, req);
   }
 
   // Check if we were terminated or simply failed
@@ -126,6 +260,17 @@ int dsm_server_start(dsm_server *s) {
   }
 
   // Cleanup
+  while (s->parked != NULL) {
+    dsm_parked *p = s->parked;
+    s->parked = p->next;
+    comm_free(&c, p->req);
+    free(p);
+  }
+  if (s->park) {
+    int wake_fd = s->wake_fd;
+    s->wake_fd = -1;
+    close(wake_fd);
+  }
   comm_shutdown(&c);
   comm_close(&c);
   return 0;
@@ -1,5 +1,6 @@
 #include <stdio.h>
 
+#include "dsm.h"
 #include "strings.h"
 
 /**
@@ -28,6 +29,20 @@ const char *strmsgtype(dsm_msg_type msg_type) {
       return "BARRIER";
     case TERMINATE:
       return "TERMINATE";
+    case PAGEDIFF:
+      return "PAGEDIFF";
+    case ACQUIRE:
+      return "ACQUIRE";
+    case PAGEUPDATE:
+      return "PAGEUPDATE";
+    case PAGEDATA:
+      return "PAGEDATA";
+    case LOCK:
+      return "LOCK";
+    case UNLOCK:
+      return "UNLOCK";
+    case LOCKGRANT:
+      return "LOCKGRANT";
     case ERROR:
       return "ERROR";
     default:
@@ -51,6 +66,14 @@ const char *strflag(int flag) {
       return "FLAG_PAGE_WRITE";
     case FLAG_PAGE_NOUPDATE:
       return "FLAG_PAGE_NOUPDATE";
+    case FLAG_PAGE_EXCLUSIVE:
+      return "FLAG_PAGE_EXCLUSIVE";
+    case FLAG_PAGE_DIRTY:
+      return "FLAG_PAGE_DIRTY";
+    case FLAG_PAGE_REDIRECT:
+      return "FLAG_PAGE_REDIRECT";
+    case FLAG_PAGE_FORWARD:
+      return "FLAG_PAGE_FORWARD";
     default:
       return "UNKNOWN";
   }
@@ -83,6 +106,33 @@ const char *strdsmerror(dsm_error error) {
   }
 }
 
+/**
+ * Returns a string representation of a DSM_SHARING_* class. The returned
+ * string is statically allocated and should not be free()d.
+ *
+ * @param sharing the class
+ *
+ * @return a statically allocated string representing the class
+ */
+const char *strsharing(int sharing) {
+  switch (sharing) {
+    case DSM_SHARING_UNKNOWN:
+      return "unknown";
+    case DSM_SHARING_PRIVATE:
+      return "private";
+    case DSM_SHARING_READMOSTLY:
+      return "read-mostly";
+    case DSM_SHARING_MIGRATORY:
+      return "migratory";
+    case DSM_SHARING_PRODCONS:
+      return "producer-consumer";
+    case DSM_SHARING_WRITESHARED:
+      return "write-shared";
+    default:
+      return "UNKNOWN";
+  }
+}
+
 /**
  * Pretty prints `n` bytes of `buf` in hex with 32 hex numbers per line.
  *
@@ -9,10 +9,16 @@ typedef struct test_options_struct {
   char host[256];
   int port;
   int node_id;
+  int fault_mode;
+  char test[32];
 } test_options;
 
 void test_ping_pong(const char *host, int port, int num_nodes, int is_master);
 int test_matrix_mul(const char* host, int port, int node_id, int nnodes, int is_master);
-int profile(const char* host, int port, int node_id, int nnodes, int is_master);
+int profile(const char* host, int port, int node_id, int nnodes, int is_master, int fault_mode);
 int demo_matrix_mul(const char* host, int port, int node_id, int nnodes, int is_master);
+int test_diff(void);
+int test_lrc(const char* host, int port, int node_id, int nnodes, int is_master, int fault_mode);
+int test_lock(const char* host, int port, int node_id, int nnodes, int is_master, int fault_mode);
+int test_dynamic(const char* host, int port, int node_id, int nnodes, int is_master, int fault_mode);
 #endif
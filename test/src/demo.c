@@ -69,7 +69,7 @@ int demo_matrix_mul(const char* host, int port, int node_id, int nnodes, int is_
   dsm *d = (dsm*)calloc(1, sizeof(dsm));
  
   // initialize 
-  dsm_init(d, host, port, is_master);
+  dsm_init(d, host, port, is_master, DSM_FAULT_SIGSEGV);
 
   // allocate shared memory 
   A = (double*)dsm_alloc(d, cid++, m*n*sizeof(double));
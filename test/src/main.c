@@ -31,7 +31,9 @@ static void usage() {
     "  -h     give this help message\n"
     "  -v     print verbose output\n"
     "  -m     make this node master\n"
-    "  -u     provide host name with this option\n",
+    "  -u     provide host name with this option\n"
+    "  -f     fault engine: sigsegv (default) or uffd\n"
+    "  -t     test to run: profile (default), diff, lrc, lock or dynamic\n",
     PROG_NAME);
 }
 
@@ -55,7 +57,7 @@ static int parse_command_line(int argc, char *argv[], test_options *opts) {
 
   // Parse the command line.
   int opt = '\0';
-  while ((opt = getopt(argc, argv, "hvmi:p:u:")) != -1) {
+  while ((opt = getopt(argc, argv, "hvmi:p:u:f:t:")) != -1) {
     switch (opt) {
       case 'h':
         usage();
@@ -75,6 +77,17 @@ static int parse_command_line(int argc, char *argv[], test_options *opts) {
       case 'i':
         opts->node_id = atoi(optarg);
         break;
+      case 'f':
+        if (strcmp(optarg, "uffd") == 0)
+          opts->fault_mode = DSM_FAULT_UFFD;
+        else if (strcmp(optarg, "sigsegv") == 0)
+          opts->fault_mode = DSM_FAULT_SIGSEGV;
+        else
+          usage_msg_exit("%s: Unknown fault engine '%s'\n", PROG_NAME, optarg);
+        break;
+      case 't':
+        strncpy(opts->test, optarg, sizeof(opts->test) - 1);
+        break;
       case '?':
       default:
         usage_msg_exit("%s: Unknown option '%c'\n", PROG_NAME, opt);
@@ -92,17 +105,32 @@ int main(int argc, char *argv[]) {
       usage_msg_exit("%s: wrong arguments\n", PROG_NAME);
   }
 
+  // the unit checks need no other node
+  if (strcmp(OPTIONS.test, "diff") == 0)
+    return test_diff() < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
   dsm_conf c;
   if (dsm_conf_init(&c, "dsm.conf", OPTIONS.host, OPTIONS.port) < 0) {
     print_err("Error parsing conf file\n");
     return -1;
   }
 
+  int error = 0;
   //test_ping_pong(OPTIONS.host, OPTIONS.port, c.num_nodes, OPTIONS.is_master);
   //test_matrix_mul(OPTIONS.host, OPTIONS.port, OPTIONS.node_id, c.num_nodes, OPTIONS.is_master);
-  profile(OPTIONS.host, OPTIONS.port, OPTIONS.node_id, c.num_nodes, OPTIONS.is_master);
+  if (strcmp(OPTIONS.test, "lrc") == 0)
+    error = test_lrc(OPTIONS.host, OPTIONS.port, OPTIONS.node_id, c.num_nodes, OPTIONS.is_master,
+        OPTIONS.fault_mode);
+  else if (strcmp(OPTIONS.test, "lock") == 0)
+    error = test_lock(OPTIONS.host, OPTIONS.port, OPTIONS.node_id, c.num_nodes, OPTIONS.is_master,
+        OPTIONS.fault_mode);
+  else if (strcmp(OPTIONS.test, "dynamic") == 0)
+    error = test_dynamic(OPTIONS.host, OPTIONS.port, OPTIONS.node_id, c.num_nodes, OPTIONS.is_master,
+        OPTIONS.fault_mode);
+  else
+    profile(OPTIONS.host, OPTIONS.port, OPTIONS.node_id, c.num_nodes, OPTIONS.is_master, OPTIONS.fault_mode);
   //demo_matrix_mul(OPTIONS.host, OPTIONS.port, OPTIONS.node_id, c.num_nodes, OPTIONS.is_master);
 
   dsm_conf_close(&c);
-  return 0; 
+  return error < 0 ? EXIT_FAILURE : EXIT_SUCCESS; 
 }
@@ -63,7 +63,7 @@ void generate_matrix(double *m, int row, int col)
   }
 }
 
-int profile(const char* host, int port, int node_id, int nnodes, int is_master) {
+int profile(const char* host, int port, int node_id, int nnodes, int is_master, int fault_mode) {
   UNUSED(nnodes);
   double *A;
   int i, j, m, n;
@@ -78,7 +78,7 @@ int profile(const char* host, int port, int node_id, int nnodes, int is_master)
   START_TIMING(ttotal);
   d = (dsm*)malloc(sizeof(dsm));
   memset(d, 0, sizeof(dsm));
-  dsm_init(d, host, port, is_master);
+  dsm_init(d, host, port, is_master, fault_mode);
 
   START_TIMING(talloc);
   // allocate shared memory 
@@ -123,9 +123,11 @@ int profile(const char* host, int port, int node_id, int nnodes, int is_master)
   
 #ifdef _MUL_STATS
   printf("----------_MUL_STATS--------\n");
+  printf("fault engine %s.\n", fault_mode == DSM_FAULT_UFFD ? "userfaultfd" : "sigsegv");
   printf("alloc %lldus.\n", talloc);
   printf("barrier %lldus.\n", tbarrier);
   printf("readfault %lldus.\n", treadfault);
+  printf("readfault per page %lldus.\n", treadfault / (m*n*(long long)sizeof(double) / PAGESIZE));
   printf("writefault %lldus.\n", twritefault);
   printf("free %lldus.\n", tfree);
   printf("close %lldus.\n", tclose);
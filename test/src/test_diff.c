@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "dsm.h"
+#include "diff.h"
+
+/**
+ * Encodes the changes of page against twin, applies them to a copy of the
+ * twin and checks that the copy came out as the page.
+ *
+ * @param[out] size size of the diff
+ * @return 0 if the page came out right; -1 otherwise
+ */
+static
+int diff_round_trip(const uint8_t *page, const uint8_t *twin, size_t len, size_t *size) {
+  uint8_t *diff = (uint8_t*)malloc(DSM_DIFF_MAX_SIZE(len));
+  uint8_t *copy = (uint8_t*)malloc(len);
+  int error = 0;
+
+  *size = dsm_diff_encode(page, twin, len, diff);
+  memcpy(copy, twin, len);
+  if (*size > DSM_DIFF_MAX_SIZE(len)) {
+    print_err("diff of %zu bytes for a page of %zu; at most %zu expected\n",
+        *size, len, (size_t)DSM_DIFF_MAX_SIZE(len));
+    error = -1;
+  } else if (dsm_diff_apply(copy, len, diff, *size) < 0) {
+    print_err("diff of %zu bytes rejected\n", *size);
+    error = -1;
+  } else if (memcmp(copy, page, len) != 0) {
+    print_err("page of %zu bytes did not survive a diff\n", len);
+    error = -1;
+  }
+
+  free(copy);
+  free(diff);
+  return error;
+}
+
+/**
+ * Changes of several shapes: none, single bytes at both ends, a run across
+ * words, every other byte (the largest diff there is) and every byte.
+ */
+static
+int test_diff_changes(size_t len) {
+  uint8_t *twin = (uint8_t*)malloc(len);
+  uint8_t *page = (uint8_t*)malloc(len);
+  size_t size = 0;
+  int failed = 0;
+
+  for (size_t i = 0; i < len; i++)
+    twin[i] = random();
+
+  memcpy(page, twin, len);
+  failed |= diff_round_trip(page, twin, len, &size) < 0;
+  if (size != 0) {
+    print_err("diff of %zu bytes for an unchanged page\n", size);
+    failed = 1;
+  }
+
+  page[0] ^= 0xff;
+  page[len - 1] ^= 0xff;
+  failed |= diff_round_trip(page, twin, len, &size) < 0;
+  if (len > 2 && size != 2*(sizeof(dsm_diff_run) + 1)) {
+    print_err("diff of %zu bytes for two changed bytes\n", size);
+    failed = 1;
+  }
+
+  memcpy(page, twin, len);
+  for (size_t i = len/4 + 3; i < len/2 + 5 && i < len; i++)
+    page[i] = ~twin[i];
+  failed |= diff_round_trip(page, twin, len, &size) < 0;
+
+  memcpy(page, twin, len);
+  for (size_t i = 0; i < len; i += 2)
+    page[i] = ~twin[i];
+  failed |= diff_round_trip(page, twin, len, &size) < 0;
+  if (size != len/2*(sizeof(dsm_diff_run) + 1)) {
+    print_err("diff of %zu bytes with every other byte of %zu changed\n", size, len);
+    failed = 1;
+  }
+
+  for (size_t i = 0; i < len; i++)
+    page[i] = ~twin[i];
+  failed |= diff_round_trip(page, twin, len, &size) < 0;
+  if (size != sizeof(dsm_diff_run) + len) {
+    print_err("diff of %zu bytes with all %zu bytes changed\n", size, len);
+    failed = 1;
+  }
+
+  free(page);
+  free(twin);
+  return failed ? -1 : 0;
+}
+
+/**
+ * Diffs which do not fit the page are turned down: runs past its end, runs
+ * longer than the bytes which follow them and truncated run headers.
+ */
+static
+int test_diff_bounds(size_t len) {
+  uint8_t page[64];
+  uint8_t diff[sizeof(dsm_diff_run) + 16];
+  int failed = 0;
+  struct {
+    const char *what;
+    dsm_diff_run run;
+    size_t size;
+  } cases[] = {
+    { "run past the end", { .offset = len - 4, .len = 8 }, sizeof(dsm_diff_run) + 8 },
+    { "run after the end", { .offset = len + 1, .len = 0 }, sizeof(dsm_diff_run) },
+    { "run wrapping around", { .offset = 8, .len = UINT32_MAX - 4 }, sizeof(dsm_diff_run) + 8 },
+    { "run longer than the diff", { .offset = 0, .len = 16 }, sizeof(dsm_diff_run) + 8 },
+    { "truncated run", { .offset = 0, .len = 1 }, sizeof(dsm_diff_run) - 1 },
+  };
+
+  memset(diff, 0xab, sizeof(diff));
+  for (size_t i = 0; i < sizeof(cases)/sizeof(cases[0]); i++) {
+    memcpy(diff, &cases[i].run, sizeof(dsm_diff_run));
+    if (dsm_diff_apply(page, len, diff, cases[i].size) == 0) {
+      print_err("diff with a %s accepted\n", cases[i].what);
+      failed = 1;
+    }
+  }
+
+  // a run which ends right at the end of the page is fine
+  dsm_diff_run last = { .offset = len - 8, .len = 8 };
+  memcpy(diff, &last, sizeof(last));
+  if (dsm_diff_apply(page, len, diff, sizeof(last) + 8) < 0 ||
+      memcmp(page + len - 8, diff + sizeof(last), 8) != 0) {
+    print_err("diff with a run up to the end rejected\n");
+    failed = 1;
+  }
+  return failed ? -1 : 0;
+}
+
+/**
+ * Checks the diffs of multiple-writer chunks; needs no other node.
+ */
+int test_diff(void) {
+  size_t lens[] = { 8, 64, PAGESIZE, 4*PAGESIZE };
+  int failed = 0;
+
+  srandom(1);
+  for (size_t i = 0; i < sizeof(lens)/sizeof(lens[0]); i++)
+    failed |= test_diff_changes(lens[i]) < 0;
+  failed |= test_diff_bounds(64) < 0;
+
+  if (!failed) printf("Success.\n");
+  else printf("Failed.\n");
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,73 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "dsm.h"
+
+#define DYN_PAGES 8
+#define DYN_ROUNDS 12
+
+/**
+ * Counts the words of page p which do not hold what its writer of round
+ * wrote: round*words + i.
+ */
+static
+int check_page(const int *page, int words, int round, int p) {
+  int wrong = 0;
+  for (int i = 0; i < words; i++) {
+    if (page[i] != round*words + i) {
+      if (wrong == 0)
+        printf("round %d: page %d word %d=%d, expected %d\n", round, p, i, page[i], round*words + i);
+      wrong++;
+    }
+  }
+  return wrong;
+}
+
+/**
+ * Dynamic chunks. Each round every page gets a new writer, another node
+ * for each page, and all nodes read all pages after a barrier. The owner
+ * of each page moves from node to node, so the probable owners the
+ * nodes keep fall behind, and faults follow the redirects of the nodes
+ * the page went through.
+ */
+int test_dynamic(const char* host, int port, int node_id, int nnodes, int is_master, int fault_mode) {
+  int words = PAGESIZE/sizeof(int);
+  int wrong = 0;
+  dsm *d;
+
+  d = (dsm*)malloc(sizeof(dsm));
+  memset(d, 0, sizeof(dsm));
+  dsm_init(d, host, port, is_master, fault_mode);
+
+  int *data = (int*)dsm_alloc_ex(d, 0, DYN_PAGES*PAGESIZE, 0, DSM_CHUNK_DYNAMIC);
+  dsm_barrier_all(d);
+
+  for (int round = 0; round < DYN_ROUNDS; round++) {
+    for (int p = 0; p < DYN_PAGES; p++) {
+      if ((round + p) % nnodes != node_id)
+        continue;
+      for (int i = 0; i < words; i++)
+        data[p*words + i] = round*words + i;
+    }
+    dsm_barrier_all(d);
+
+    for (int p = 0; p < DYN_PAGES; p++)
+      wrong += check_page(&data[p*words], words, round, p);
+    dsm_barrier_all(d);
+  }
+
+  dsm_sharing_stats stats;
+  if (dsm_get_sharing_stats(d, 0, &stats) == 0)
+    printf("Faults redirected to another probable owner: %"PRIu64"\n", stats.redirects);
+  dsm_barrier_all(d);
+
+  dsm_free(d, 0);
+  dsm_close(d);
+  free((void*)d);
+
+  if (wrong == 0) printf("Success.\n");
+  else printf("Failed: %d wrong words.\n", wrong);
+  return wrong == 0 ? 0 : -1;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "utils.h"
+#include "dsm.h"
+
+#define LOCK_PAGES 4
+#define LOCK_ITERS 200
+#define LOCK_ID 0
+
+/**
+ * Lock handoff. All nodes take the same lock over and over and, holding
+ * it, append their id to a list in a multiple-writer chunk. Each holder
+ * must see the list as the last holder left it, and nobody else in the
+ * critical section. The list spans several pages, so each handoff carries
+ * the diffs of a page the next holder may not have a copy of.
+ *
+ * Word 0 of the chunk is the length of the list, word 1 the node in the
+ * critical section (-1 if none), and the list follows.
+ */
+int test_lock(const char* host, int port, int node_id, int nnodes, int is_master, int fault_mode) {
+  int n = LOCK_PAGES*PAGESIZE/sizeof(int);
+  int iters = (n - 2)/nnodes < LOCK_ITERS ? (n - 2)/nnodes : LOCK_ITERS;
+  int handoffs = 0;
+  int wrong = 0;
+  dsm *d;
+
+  d = (dsm*)malloc(sizeof(dsm));
+  memset(d, 0, sizeof(dsm));
+  dsm_init(d, host, port, is_master, fault_mode);
+  dsm_lock_init(d, LOCK_ID);
+
+  int *words = (int*)dsm_alloc_ex(d, 0, n*sizeof(int), 0, DSM_CHUNK_MULTIWRITER);
+  int *len = &words[0];
+  int *inside = &words[1];
+  int *order = &words[2];
+  if (node_id == 0) {
+    *len = 0;
+    *inside = -1;
+  }
+  dsm_barrier_all(d);
+
+  for (int i = 0; i < iters; i++) {
+    if (dsm_lock(d, LOCK_ID) < 0) {
+      print_err("Could not take lock %d\n", LOCK_ID);
+      wrong++;
+      break;
+    }
+    if (*inside != -1) {
+      if (wrong == 0)
+        printf("node %d in the critical section along with node %d\n", node_id, *inside);
+      wrong++;
+    }
+    *inside = node_id;
+    if (*len > 0 && order[*len - 1] != node_id)
+      handoffs++;
+    order[*len] = node_id;
+    (*len)++;
+    // let the others queue up
+    if (i % 16 == 0)
+      usleep(100);
+    *inside = -1;
+    if (dsm_unlock(d, LOCK_ID) < 0) {
+      print_err("Could not release lock %d\n", LOCK_ID);
+      wrong++;
+      break;
+    }
+  }
+  dsm_barrier_all(d);
+
+  // each node shows up in the list once for each time it held the lock
+  int *count = (int*)calloc(nnodes, sizeof(int));
+  if (*len != nnodes*iters) {
+    printf("list of %d entries, expected %d\n", *len, nnodes*iters);
+    wrong++;
+  }
+  for (int i = 0; i < *len && i < n - 2; i++) {
+    if (order[i] < 0 || order[i] >= nnodes) {
+      if (wrong == 0)
+        printf("order[%d]=%d, not a node\n", i, order[i]);
+      wrong++;
+    } else {
+      count[order[i]]++;
+    }
+  }
+  for (int i = 0; i < nnodes; i++) {
+    if (count[i] != iters) {
+      printf("node %d held the lock %d times, expected %d\n", i, count[i], iters);
+      wrong++;
+    }
+  }
+  free(count);
+  printf("Lock handed over to this node %d times.\n", handoffs);
+  dsm_barrier_all(d);
+
+  dsm_free(d, 0);
+  dsm_close(d);
+  free((void*)d);
+
+  if (wrong == 0) printf("Success.\n");
+  else printf("Failed: %d errors.\n", wrong);
+  return wrong == 0 ? 0 : -1;
+}
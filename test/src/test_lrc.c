@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "utils.h"
+#include "dsm.h"
+
+#define LRC_PAGES 4
+#define LRC_ROUNDS 8
+
+/**
+ * Counts the words of data which do not hold what the writer of round
+ * wrote: round*n + i.
+ */
+static
+int check_round(const int *data, int n, int round) {
+  int wrong = 0;
+  for (int i = 0; i < n; i++) {
+    if (data[i] != round*n + i) {
+      if (wrong == 0)
+        printf("round %d: data[%d]=%d, expected %d\n", round, i, data[i], round*n + i);
+      wrong++;
+    }
+  }
+  return wrong;
+}
+
+/**
+ * Lazy release consistency. Each round one node writes all pages of a
+ * multiple-writer chunk, releases them and raises a flag in a
+ * single-writer chunk. The other nodes hold copies of the pages from the
+ * round before; once they see the flag they acquire, which drops those
+ * copies, and must read the writes of the round. Then all nodes write
+ * their own words of the same pages at once, and the barrier merges them.
+ */
+int test_lrc(const char* host, int port, int node_id, int nnodes, int is_master, int fault_mode) {
+  int n = LRC_PAGES*PAGESIZE/sizeof(int);
+  int wrong = 0;
+  dsm *d;
+
+  d = (dsm*)malloc(sizeof(dsm));
+  memset(d, 0, sizeof(dsm));
+  dsm_init(d, host, port, is_master, fault_mode);
+
+  int *data = (int*)dsm_alloc_ex(d, 0, n*sizeof(int), 0, DSM_CHUNK_MULTIWRITER);
+  volatile int *flag = (volatile int*)dsm_alloc(d, 1, PAGESIZE);
+  if (node_id == 0) {
+    for (int i = 0; i < n; i++)
+      data[i] = i;
+    *flag = 0;
+  }
+  dsm_barrier_all(d);
+
+  for (int round = 1; round <= LRC_ROUNDS; round++) {
+    // every node keeps a copy of the pages as of the last round
+    wrong += check_round(data, n, round - 1);
+    dsm_barrier_all(d);
+
+    if (node_id == round % nnodes) {
+      for (int i = 0; i < n; i++)
+        data[i] = round*n + i;
+      dsm_release(d);
+      *flag = round;
+    } else {
+      while (*flag != round)
+        usleep(100);
+      dsm_acquire(d);
+      wrong += check_round(data, n, round);
+    }
+    dsm_barrier_all(d);
+  }
+
+  // concurrent writers to the same pages; the words of node i are i mod nnodes
+  for (int i = node_id; i < n; i += nnodes)
+    data[i] = -i;
+  dsm_barrier_all(d);
+  for (int i = 0; i < n; i++) {
+    if (data[i] != -i) {
+      if (wrong == 0)
+        printf("merge: data[%d]=%d, expected %d\n", i, data[i], -i);
+      wrong++;
+    }
+  }
+  dsm_barrier_all(d);
+
+  dsm_free(d, 0);
+  dsm_free(d, 1);
+  dsm_close(d);
+  free((void*)d);
+
+  if (wrong == 0) printf("Success.\n");
+  else printf("Failed: %d wrong words.\n", wrong);
+  return wrong == 0 ? 0 : -1;
+}
@@ -130,7 +130,7 @@ int test_matrix_mul(const char* host, int port, int node_id, int nnodes, int is_
   START_TIMING(ttotal);
   d = (dsm*)malloc(sizeof(dsm));
   memset(d, 0, sizeof(dsm));
-  dsm_init(d, host, port, is_master);
+  dsm_init(d, host, port, is_master, DSM_FAULT_SIGSEGV);
 
   START_TIMING(talloc);
   // allocate shared memory 
@@ -173,6 +173,16 @@ int test_matrix_mul(const char* host, int port, int node_id, int nnodes, int is_
   double *result = multiply_partition(A, B, m, n, p, pb, psz);
   END_TIMING(tmultiply);
 
+#ifdef _MUL_STATS
+  // B is walked column-wise; see whether prefetching kept up
+  dsm_prefetch_stats pf;
+  dsm_protect_stats pr;
+  memset(&pf, 0, sizeof(pf));
+  memset(&pr, 0, sizeof(pr));
+  dsm_get_prefetch_stats(d, 1, &pf);
+  dsm_get_protect_stats(d, 1, &pr);
+#endif
+
   // finally copy the result into shared memory
   START_TIMING(twriteC);
   for (i = pb*p; i < pb*p + psz*p && i < m*p; i++) {
@@ -237,6 +247,11 @@ OUT_FALSE:
   printf("barrier2 %lldus.\n", tbarrier2);
   printf("write C %lldus.\n", twriteC);
   printf("multiply %lldus.\n", tmultiply);
+  printf("prefetch B read-ahead/stride pages %llu/%llu, stride hits/misses %llu/%llu.\n",
+      (unsigned long long)pf.readahead_pages, (unsigned long long)pf.stride_pages,
+      (unsigned long long)pf.stride_hits, (unsigned long long)pf.stride_misses);
+  printf("protection changes B %llu for %llu pages.\n",
+      (unsigned long long)pr.calls, (unsigned long long)pr.pages);
   printf("free %lldus.\n", tfree);
   printf("close %lldus.\n", tclose);
   printf("total %lldus.\n", ttotal);
@@ -24,7 +24,7 @@ int test_dsm_master(const char *host, int port, int num_nodes, int is_master) {
   d->is_master = is_master;
   memcpy(d->host, host, 1+host_len);
 
-  if (dsm_init(d, host, port, is_master) < 0)
+  if (dsm_init(d, host, port, is_master, DSM_FAULT_SIGSEGV) < 0)
     return 0;
 
   char *buffer = (char*)dsm_alloc(d, g_chunk_id, 4*PAGESIZE); 
@@ -60,7 +60,7 @@ int test_dsm_client_n(const char *host, int port, int num_nodes, int is_master)
   d->is_master = is_master;
   memcpy(d->host, host, 1+host_len);
   
-  if (dsm_init(d, host, port, is_master) < 0)
+  if (dsm_init(d, host, port, is_master, DSM_FAULT_SIGSEGV) < 0)
     return 0;
 
   char *buffer = (char*)dsm_alloc(d, g_chunk_id, 4*PAGESIZE); 